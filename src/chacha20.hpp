@@ -0,0 +1,216 @@
+// Copyright (C) 2019 hrobeers (https://github.com/hrobeers)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef CHACHA20_HPP
+#define CHACHA20_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#  include <immintrin.h>
+#  define STENOMESH_CHACHA20_SIMD
+#endif
+
+namespace stenomesh {
+  // ChaCha20 stream cipher as in RFC 8439: 256 bit key, 96 bit nonce and a 32 bit block counter.
+  // Keystreams of 8 blocks use AVX2 when the cpu has it, 4 blocks SSE2, the tail is scalar.
+  namespace chacha20_detail {
+    typedef std::array<uint32_t,16> state_t;
+
+    inline uint32_t load32(const unsigned char *p) {
+      return uint32_t(p[0]) | uint32_t(p[1])<<8 | uint32_t(p[2])<<16 | uint32_t(p[3])<<24;
+    }
+
+    inline state_t init(const unsigned char *key, const unsigned char *nonce, uint32_t counter) {
+      state_t s = { 0x61707865, 0x3320646e, 0x79622d32, 0x6b206574 }; // "expand 32-byte k"
+      for (int i=0; i<8; i++)
+        s[4+i] = load32(key+4*i);
+      s[12] = counter;
+      for (int i=0; i<3; i++)
+        s[13+i] = load32(nonce+4*i);
+      return s;
+    }
+
+    inline uint32_t rotl(uint32_t v, int n) {
+      return (v<<n) | (v>>(32-n));
+    }
+
+    inline void quarter_round(state_t &x, int a, int b, int c, int d) {
+      x[a] += x[b]; x[d] = rotl(x[d]^x[a], 16);
+      x[c] += x[d]; x[b] = rotl(x[b]^x[c], 12);
+      x[a] += x[b]; x[d] = rotl(x[d]^x[a], 8);
+      x[c] += x[d]; x[b] = rotl(x[b]^x[c], 7);
+    }
+
+    // One 64 byte keystream block
+    inline void block(const state_t &s, unsigned char *out) {
+      state_t x = s;
+      for (int i=0; i<10; i++) {
+        quarter_round(x, 0, 4,  8, 12);
+        quarter_round(x, 1, 5,  9, 13);
+        quarter_round(x, 2, 6, 10, 14);
+        quarter_round(x, 3, 7, 11, 15);
+        quarter_round(x, 0, 5, 10, 15);
+        quarter_round(x, 1, 6, 11, 12);
+        quarter_round(x, 2, 7,  8, 13);
+        quarter_round(x, 3, 4,  9, 14);
+      }
+      for (int i=0; i<16; i++) {
+        uint32_t v = x[i]+s[i];
+        out[4*i] = v; out[4*i+1] = v>>8; out[4*i+2] = v>>16; out[4*i+3] = v>>24;
+      }
+    }
+
+#ifdef STENOMESH_CHACHA20_SIMD
+    // Rounds on 16 registers holding one state word of each block.
+    // Macros rather than lambdas, which would not inherit the target attribute.
+#   define STENOMESH_CHACHA20_QR(add, xor_, rot, a, b, c, d)            \
+    x[a] = add(x[a], x[b]); x[d] = rot(xor_(x[d], x[a]), 16);           \
+    x[c] = add(x[c], x[d]); x[b] = rot(xor_(x[b], x[c]), 12);           \
+    x[a] = add(x[a], x[b]); x[d] = rot(xor_(x[d], x[a]), 8);            \
+    x[c] = add(x[c], x[d]); x[b] = rot(xor_(x[b], x[c]), 7);
+#   define STENOMESH_CHACHA20_ROUNDS(add, xor_, rot)                    \
+    for (int r=0; r<10; r++) {                                          \
+      STENOMESH_CHACHA20_QR(add, xor_, rot, 0, 4,  8, 12);              \
+      STENOMESH_CHACHA20_QR(add, xor_, rot, 1, 5,  9, 13);              \
+      STENOMESH_CHACHA20_QR(add, xor_, rot, 2, 6, 10, 14);              \
+      STENOMESH_CHACHA20_QR(add, xor_, rot, 3, 7, 11, 15);              \
+      STENOMESH_CHACHA20_QR(add, xor_, rot, 0, 5, 10, 15);              \
+      STENOMESH_CHACHA20_QR(add, xor_, rot, 1, 6, 11, 12);              \
+      STENOMESH_CHACHA20_QR(add, xor_, rot, 2, 7,  8, 13);              \
+      STENOMESH_CHACHA20_QR(add, xor_, rot, 3, 4,  9, 14);              \
+    }
+
+    inline __m128i rotl_sse2(__m128i v, int n) {
+      return _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32-n));
+    }
+
+    // Xors 4 blocks (256 bytes) of keystream starting at counter s[12]
+    inline void xor4_sse2(const state_t &s, const unsigned char *in, unsigned char *out) {
+      __m128i init[16], x[16];
+      for (int i=0; i<16; i++)
+        init[i] = _mm_set1_epi32(int(s[i]));
+      init[12] = _mm_add_epi32(init[12], _mm_set_epi32(3, 2, 1, 0));
+      for (int i=0; i<16; i++)
+        x[i] = init[i];
+      STENOMESH_CHACHA20_ROUNDS(_mm_add_epi32, _mm_xor_si128, rotl_sse2);
+      for (int i=0; i<16; i++)
+        x[i] = _mm_add_epi32(x[i], init[i]);
+
+      // Transpose word groups of 4, u[k] holds 16 bytes of block k
+      for (int g=0; g<4; g++) {
+        __m128i t0 = _mm_unpacklo_epi32(x[4*g], x[4*g+1]);
+        __m128i t1 = _mm_unpackhi_epi32(x[4*g], x[4*g+1]);
+        __m128i t2 = _mm_unpacklo_epi32(x[4*g+2], x[4*g+3]);
+        __m128i t3 = _mm_unpackhi_epi32(x[4*g+2], x[4*g+3]);
+        __m128i u[4] = { _mm_unpacklo_epi64(t0, t2), _mm_unpackhi_epi64(t0, t2),
+                         _mm_unpacklo_epi64(t1, t3), _mm_unpackhi_epi64(t1, t3) };
+        for (int k=0; k<4; k++) {
+          const size_t o = 64*k + 16*g;
+          __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in+o));
+          _mm_storeu_si128(reinterpret_cast<__m128i*>(out+o), _mm_xor_si128(v, u[k]));
+        }
+      }
+    }
+
+    // Byte rotations are a single shuffle, n is a constant once inlined
+    __attribute__((target("avx2")))
+    inline __m256i rotl_avx2(__m256i v, int n) {
+      if (n==16)
+        return _mm256_shuffle_epi8(v, _mm256_set_epi8(13,12,15,14, 9,8,11,10, 5,4,7,6, 1,0,3,2,
+                                                      13,12,15,14, 9,8,11,10, 5,4,7,6, 1,0,3,2));
+      if (n==8)
+        return _mm256_shuffle_epi8(v, _mm256_set_epi8(14,13,12,15, 10,9,8,11, 6,5,4,7, 2,1,0,3,
+                                                      14,13,12,15, 10,9,8,11, 6,5,4,7, 2,1,0,3));
+      return _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32-n));
+    }
+
+    // Xors 8 blocks (512 bytes) of keystream starting at counter s[12]
+    __attribute__((target("avx2")))
+    inline void xor8_avx2(const state_t &s, const unsigned char *in, unsigned char *out) {
+      __m256i init[16], x[16];
+      for (int i=0; i<16; i++)
+        init[i] = _mm256_set1_epi32(int(s[i]));
+      init[12] = _mm256_add_epi32(init[12], _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+      for (int i=0; i<16; i++)
+        x[i] = init[i];
+      STENOMESH_CHACHA20_ROUNDS(_mm256_add_epi32, _mm256_xor_si256, rotl_avx2);
+      for (int i=0; i<16; i++)
+        x[i] = _mm256_add_epi32(x[i], init[i]);
+
+      // Per 128 bit lane transpose as for SSE2, lane 0 holds blocks 0-3 and lane 1 blocks 4-7
+      __m256i u[4][4];
+      for (int g=0; g<4; g++) {
+        __m256i t0 = _mm256_unpacklo_epi32(x[4*g], x[4*g+1]);
+        __m256i t1 = _mm256_unpackhi_epi32(x[4*g], x[4*g+1]);
+        __m256i t2 = _mm256_unpacklo_epi32(x[4*g+2], x[4*g+3]);
+        __m256i t3 = _mm256_unpackhi_epi32(x[4*g+2], x[4*g+3]);
+        u[g][0] = _mm256_unpacklo_epi64(t0, t2);
+        u[g][1] = _mm256_unpackhi_epi64(t0, t2);
+        u[g][2] = _mm256_unpacklo_epi64(t1, t3);
+        u[g][3] = _mm256_unpackhi_epi64(t1, t3);
+      }
+      for (int k=0; k<4; k++) {
+        const __m256i ks[4] = { _mm256_permute2x128_si256(u[0][k], u[1][k], 0x20),  // block k, bytes 0-31
+                                _mm256_permute2x128_si256(u[2][k], u[3][k], 0x20),  // block k, bytes 32-63
+                                _mm256_permute2x128_si256(u[0][k], u[1][k], 0x31),  // block k+4, bytes 0-31
+                                _mm256_permute2x128_si256(u[2][k], u[3][k], 0x31) }; // block k+4, bytes 32-63
+        const size_t o[4] = { 64*size_t(k), 64*size_t(k)+32, 64*size_t(k+4), 64*size_t(k+4)+32 };
+        for (int j=0; j<4; j++) {
+          __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in+o[j]));
+          _mm256_storeu_si256(reinterpret_cast<__m256i*>(out+o[j]), _mm256_xor_si256(v, ks[j]));
+        }
+      }
+    }
+#   undef STENOMESH_CHACHA20_ROUNDS
+#   undef STENOMESH_CHACHA20_QR
+
+    inline bool has_avx2() {
+      static const bool has = __builtin_cpu_supports("avx2");
+      return has;
+    }
+#endif
+  }
+
+  // Writes in xor the keystream from block counter on to out, in and out are the same or do not overlap
+  inline void chacha20_xor(const unsigned char *key, const unsigned char *nonce, uint32_t counter,
+                           const void *in, void *out, size_t n) {
+    using namespace chacha20_detail;
+    const unsigned char *ip = static_cast<const unsigned char*>(in);
+    unsigned char *op = static_cast<unsigned char*>(out);
+    state_t s = init(key, nonce, counter);
+#ifdef STENOMESH_CHACHA20_SIMD
+    if (has_avx2())
+      for (; n>=512; n-=512, ip+=512, op+=512, s[12]+=8)
+        xor8_avx2(s, ip, op);
+    for (; n>=256; n-=256, ip+=256, op+=256, s[12]+=4)
+      xor4_sse2(s, ip, op);
+#endif
+    unsigned char ks[64];
+    for (; n>0; s[12]++) {
+      block(s, ks);
+      const size_t m = std::min<size_t>(n, 64);
+      for (size_t i=0; i<m; i++)
+        op[i] = ip[i]^ks[i];
+      n -= m; ip += m; op += m;
+    }
+  }
+}
+
+#endif // CHACHA20_HPP
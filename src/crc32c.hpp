@@ -0,0 +1,100 @@
+// Copyright (C) 2019 hrobeers (https://github.com/hrobeers)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef CRC32C_HPP
+#define CRC32C_HPP
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#  include <nmmintrin.h>
+#  define STENOMESH_CRC32C_SSE42
+#endif
+
+namespace stenomesh {
+  // CRC-32C (Castagnoli), with the SSE4.2 crc32 instruction when the cpu has it
+  // and slicing by 8 tables otherwise.
+  namespace crc32c_detail {
+    typedef std::array<std::array<uint32_t,256>,8> tables_t;
+
+    inline const tables_t& tables() {
+      static const tables_t t = []() {
+                                  tables_t t;
+                                  for (uint32_t i=0; i<256; i++) {
+                                    uint32_t c = i;
+                                    for (int k=0; k<8; k++)
+                                      c = (c>>1) ^ (0x82f63b78 & (0u-(c&1)));
+                                    t[0][i] = c;
+                                  }
+                                  for (size_t s=1; s<8; s++)
+                                    for (uint32_t i=0; i<256; i++)
+                                      t[s][i] = (t[s-1][i]>>8) ^ t[0][t[s-1][i]&0xff];
+                                  return t;
+                                }();
+      return t;
+    }
+
+    inline uint32_t crc_table(uint32_t crc, const unsigned char *p, size_t n) {
+      const tables_t &t = tables();
+      for (; n>=8; n-=8, p+=8) {
+        uint64_t v;
+        std::memcpy(&v, p, 8); // TODO big endian support
+        v ^= crc;
+        crc = t[7][v&0xff] ^ t[6][(v>>8)&0xff] ^ t[5][(v>>16)&0xff] ^ t[4][(v>>24)&0xff] ^
+          t[3][(v>>32)&0xff] ^ t[2][(v>>40)&0xff] ^ t[1][(v>>48)&0xff] ^ t[0][v>>56];
+      }
+      for (; n>0; n--, p++)
+        crc = (crc>>8) ^ t[0][(crc^*p)&0xff];
+      return crc;
+    }
+
+#ifdef STENOMESH_CRC32C_SSE42
+    __attribute__((target("sse4.2")))
+    inline uint32_t crc_sse42(uint32_t crc, const unsigned char *p, size_t n) {
+      uint64_t c = crc;
+      for (; n>=8; n-=8, p+=8) {
+        uint64_t v;
+        std::memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+      }
+      crc = uint32_t(c);
+      for (; n>0; n--, p++)
+        crc = _mm_crc32_u8(crc, *p);
+      return crc;
+    }
+
+    inline bool has_sse42() {
+      static const bool has = __builtin_cpu_supports("sse4.2");
+      return has;
+    }
+#endif
+  }
+
+  // Continues crc over n more bytes, start with crc 0
+  inline uint32_t crc32c(const void *data, size_t n, uint32_t crc = 0) {
+    const unsigned char *p = static_cast<const unsigned char*>(data);
+    crc = ~crc;
+#ifdef STENOMESH_CRC32C_SSE42
+    if (crc32c_detail::has_sse42())
+      return ~crc32c_detail::crc_sse42(crc, p, n);
+#endif
+    return ~crc32c_detail::crc_table(crc, p, n);
+  }
+}
+
+#endif // CRC32C_HPP
@@ -0,0 +1,455 @@
+// Copyright (C) 2019 hrobeers (https://github.com/hrobeers)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef EXTWELD_HPP
+#define EXTWELD_HPP
+
+#include <algorithm>
+#include <array>
+#include <vector>
+#include <string>
+#include <memory>
+#include <queue>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+
+#include "meshproc.hpp"
+#include "radixsort.hpp"
+#include "stlio.hpp"
+#include "plyio.hpp"
+
+namespace stenomesh {
+  struct file_closer
+  {
+    void operator()(FILE *f) const { fclose(f); }
+  };
+  typedef std::unique_ptr<FILE, file_closer> file_ptr;
+
+  // Temporary file in $TMPDIR, unlinked right away so it is removed when closed
+  inline file_ptr temp_file() {
+    const char *dir = std::getenv("TMPDIR");
+    std::string path = std::string(dir && *dir? dir : "/tmp") + "/stenomesh.XXXXXX";
+    int fd = mkstemp(&path[0]);
+    if (fd<0)
+      throw std::runtime_error(std::string("Cannot create temporary file: ") + std::strerror(errno));
+    unlink(path.c_str());
+    FILE *f = fdopen(fd, "w+b");
+    if (!f) {
+      close(fd);
+      throw std::runtime_error(std::string("Cannot open temporary file: ") + std::strerror(errno));
+    }
+    return file_ptr(f);
+  }
+
+  template<typename T>
+  void write_records(FILE *f, const T *data, size_t n) {
+    if (n && std::fwrite(data, sizeof(T), n, f)!=n)
+      throw std::runtime_error("Temporary file write failed");
+  }
+
+  // Reads n records at record offset pos, independent of the FILE position
+  template<typename T>
+  void pread_records(FILE *f, T *data, size_t n, size_t pos) {
+    char *dst = reinterpret_cast<char*>(data);
+    size_t size = n*sizeof(T);
+    off_t offset = pos*sizeof(T);
+    while (size) {
+      ssize_t r = pread(fileno(f), dst, size, offset);
+      if (r<0 && errno==EINTR) continue;
+      if (r<=0)
+        throw std::runtime_error("Temporary file read failed");
+      dst += r;
+      size -= r;
+      offset += r;
+    }
+  }
+
+  template<typename T>
+  void pwrite_records(FILE *f, const T *data, size_t n, size_t pos) {
+    const char *src = reinterpret_cast<const char*>(data);
+    size_t size = n*sizeof(T);
+    off_t offset = pos*sizeof(T);
+    while (size) {
+      ssize_t w = pwrite(fileno(f), src, size, offset);
+      if (w<0 && errno==EINTR) continue;
+      if (w<0)
+        throw std::runtime_error("Temporary file write failed");
+      src += w;
+      size -= w;
+      offset += w;
+    }
+  }
+
+  // Triangle mesh with its facets in a temporary file, 3 vertices per facet
+  struct SpilledMesh
+  {
+    typedef float float_t;
+    typedef std::array<float_t,3> vertex_t;
+    typedef std::array<vertex_t,3> facet_t;
+
+    file_ptr faces;
+    size_t face_count = 0;
+    std::array<vertex_t,2> bbox = {};
+    std::string comment;
+    std::string steno_msg;
+    uint32_t steno_flags = 0;
+  };
+
+  inline size_t triangle_count(const SpilledMesh &mesh) {
+    return mesh.face_count;
+  }
+
+  // Corners are numbered in memory, chunk by chunk of the spilled facets
+  inline uint64_t stl_vertex_count(const SpilledMesh &mesh) {
+    std::fflush(mesh.faces.get());
+    record_vertices corners;
+    std::vector<SpilledMesh::facet_t> chunk;
+    for (size_t begin=0; begin<mesh.face_count; begin+=stl_chunk_faces) {
+      chunk.resize(std::min(stl_chunk_faces, mesh.face_count-begin));
+      pread_records(mesh.faces.get(), chunk.data(), chunk.size(), begin);
+      for (const auto &t : chunk)
+        for (const auto &v : t)
+          corners(v);
+    }
+    return corners.size();
+  }
+
+  inline std::array<SpilledMesh::vertex_t,2> bounding_box(const SpilledMesh &mesh) {
+    return mesh.bbox;
+  }
+
+  inline std::ostream& writeSTL(const SpilledMesh &mesh, std::array<float,3> scale, std::ostream &os, bool ignore_msg_length = false, size_t threads = 1,
+                                const facet_layout &layout = facet_layout()) {
+    std::fflush(mesh.faces.get());
+    auto facets = [&mesh](size_t begin, size_t end, auto f) {
+                    std::vector<SpilledMesh::facet_t> chunk(end-begin);
+                    pread_records(mesh.faces.get(), chunk.data(), chunk.size(), begin);
+                    for (const auto &t : chunk)
+                      f(t[0], t[1], t[2], static_cast<const SpilledMesh::vertex_t*>(nullptr));
+                  };
+    return write_stl_facets(os, mesh.comment, mesh.steno_msg, mesh.steno_flags, mesh.face_count, facets, scale, ignore_msg_length, threads, layout);
+  }
+
+  inline std::ostream& writeSTL(const SpilledMesh &mesh, std::ostream &os, bool ignore_msg_length = false, size_t threads = 1,
+                                const facet_layout &layout = facet_layout()) {
+    return writeSTL(mesh, {1,1,1}, os, ignore_msg_length, threads, layout);
+  }
+
+  // PLY output of spilled meshes is a triangle soup, vertex 3*i+k is corner k of facet i
+  inline size_t ply_element_count(const SpilledMesh &mesh, bool faces) {
+    return faces? mesh.face_count : 3*mesh.face_count;
+  }
+
+  inline std::ostream& writePLY(const SpilledMesh &mesh, std::ostream &os, bool face_payload,
+                                bool ignore_msg_length = false, size_t threads = 1, const facet_placement &placement = facet_placement()) {
+    std::fflush(mesh.faces.get());
+    auto vertices = [&mesh](size_t begin, size_t end, auto f) {
+                      std::vector<SpilledMesh::facet_t> chunk((end+2)/3-begin/3);
+                      pread_records(mesh.faces.get(), chunk.data(), chunk.size(), begin/3);
+                      for (size_t i=begin; i<end; i++)
+                        f(chunk[i/3-begin/3][i%3]);
+                    };
+    auto faces = [](size_t begin, size_t end, auto f) {
+                   for (size_t i=begin; i<end; i++) {
+                     const uint32_t idx[3] = { uint32_t(3*i), uint32_t(3*i+1), uint32_t(3*i+2) };
+                     f(idx, 3);
+                   }
+                 };
+    return write_ply_elements(os, mesh.comment, mesh.steno_msg, mesh.steno_flags, 3*mesh.face_count, vertices, mesh.face_count, faces,
+                              face_payload, ignore_msg_length, threads, placement);
+  }
+
+  // External memory equivalent of vertex_merge_sorted on an unwelded facet stream, within max_memory bytes.
+  //  1. Facet corners are keyed on their quantized cell and spilled as sorted runs.
+  //  2. The runs are merged, every corner takes the vertex of the first corner in its cell
+  //     and is distributed to the partition of its corner range.
+  //  3. Partitions are loaded in corner order, collapsed facets are dropped
+  //     and the remaining ones are transformed.
+  // The steps run one after the other and each keeps its buffers within max_memory.
+  class external_welder
+  {
+    typedef SpilledMesh::vertex_t vertex_t;
+    typedef std::array<ssize_t,3> cell_t;
+
+    struct corner_record
+    {
+      cell_t cell;
+      uint64_t corner;
+      vertex_t vertex;
+    };
+
+    struct placed_record
+    {
+      uint64_t corner;
+      vertex_t vertex;
+    };
+
+    // Least records a run is read by when merging
+    static const size_t min_block = 64;
+
+  public:
+    external_welder(double dist, size_t max_memory, size_t threads = 1)
+      : _fprec(dist>0? 1/dist : 0), _max_memory(std::max<size_t>(max_memory, 1<<16)), _threads(threads),
+        _runs_file(temp_file()) {
+      // Run records and the sort items with their scratch copy
+      _run.reserve(std::max<size_t>(1<<10, _max_memory/(sizeof(corner_record)+2*sizeof(keyed<uint32_t>))));
+    }
+
+    void operator()(const std::array<vertex_t,3> &v) {
+      for (const auto &vertex : v) {
+        _run.push_back({ cell(vertex), _corners++, vertex });
+        if (_run.size()==_run.capacity())
+          spill();
+      }
+    }
+
+    SpilledMesh finish(const affine_t &m = identity_affine) {
+      spill();
+      _run = std::vector<corner_record>();
+      SpilledMesh mesh;
+      mesh.faces = temp_file();
+      if (_corners==0)
+        return mesh;
+
+      // Partitions of whole facets fitting the memory with their vertices and kept facets
+      const size_t corner_bytes = sizeof(placed_record)+sizeof(vertex_t)+sizeof(SpilledMesh::facet_t)/3;
+      const size_t part_corners = std::max<size_t>(3, _max_memory/corner_bytes/3*3);
+      const size_t parts = (_corners+part_corners-1)/part_corners;
+      file_ptr placed = temp_file();
+      merge_runs(placed.get(), part_corners, parts);
+      _runs_file.reset();
+
+      std::vector<placed_record> records;
+      std::vector<vertex_t> vertices;
+      std::vector<SpilledMesh::facet_t> facets;
+      facets.reserve(std::min<uint64_t>(_corners, part_corners)/3);
+      for (size_t p=0; p<parts; p++) {
+        trace_span span("weld partition");
+        size_t begin = p*part_corners;
+        size_t n = std::min(_corners, begin+part_corners) - begin;
+        records.resize(n);
+        vertices.resize(n);
+        pread_records(placed.get(), records.data(), n, begin);
+        for (const auto &r : records)
+          vertices[r.corner-begin] = r.vertex;
+        // Welded corners share the exact vertex of their cell
+        facets.clear();
+        for (size_t c=0; c+2<n; c+=3) {
+          SpilledMesh::facet_t f = { vertices[c], vertices[c+1], vertices[c+2] };
+          if (!same(f[0], f[1]) && !same(f[1], f[2]) && !same(f[0], f[2]))
+            facets.push_back(f);
+        }
+
+        if (m!=identity_affine) {
+          auto apply = [&m](vertex_t &v) {
+                         const float x = v[0], y = v[1], z = v[2];
+                         v[0] = m[0]*x + m[1]*y + m[2]*z + m[3];
+                         v[1] = m[4]*x + m[5]*y + m[6]*z + m[7];
+                         v[2] = m[8]*x + m[9]*y + m[10]*z + m[11];
+                       };
+          const bool invert = affine_determinant(m) < 0;
+          for (auto &v : vertices)
+            apply(v);
+          for (auto &f : facets) {
+            for (auto &v : f)
+              apply(v);
+            if (invert)
+              std::swap(f[0], f[1]);
+          }
+        }
+
+        if (p==0)
+          mesh.bbox = { vertices.front(), vertices.front() };
+        for (const auto &v : vertices)
+          for (size_t i=0; i<3; i++) {
+            mesh.bbox[0][i] = std::min(mesh.bbox[0][i], v[i]);
+            mesh.bbox[1][i] = std::max(mesh.bbox[1][i], v[i]);
+          }
+        write_records(mesh.faces.get(), facets.data(), facets.size());
+        mesh.face_count += facets.size();
+      }
+      return mesh;
+    }
+
+  private:
+    cell_t cell(const vertex_t &v) const {
+      if (_fprec>0)
+        return multiply<vertex_t, cell_t>(v, _fprec);
+      return { ssize_t(float_bits(v[0])), ssize_t(float_bits(v[1])), ssize_t(float_bits(v[2])) };
+    }
+
+    static bool same(const vertex_t &a, const vertex_t &b) {
+      return std::memcmp(a.data(), b.data(), sizeof(vertex_t))==0;
+    }
+
+    // Sorts the run on cell, stable so equal cells stay in corner order, and appends it to the runs file
+    void spill() {
+      const size_t n = _run.size();
+      if (n==0) return;
+      trace_span span("spill run");
+      cell_t lo = _run.front().cell;
+      for (const auto &r : _run)
+        for (size_t i=0; i<3; i++)
+          lo[i] = std::min(lo[i], r.cell[i]);
+
+      std::vector<keyed<uint32_t>> items(n);
+      for (size_t i=3; i-->0;) {
+        for (size_t j=0; j<n; j++) {
+          uint32_t r = i==2? uint32_t(j) : items[j].val;
+          items[j] = { uint64_t(_run[r].cell[i]-lo[i]), r };
+        }
+        radix_sort(items, _threads);
+      }
+
+      // Written through a small block, the run and the sort items take the memory
+      std::vector<corner_record> sorted(std::min<size_t>(n, 1<<12));
+      for (size_t j=0; j<n; j+=sorted.size()) {
+        const size_t m = std::min(sorted.size(), n-j);
+        for (size_t k=0; k<m; k++)
+          sorted[k] = _run[items[j+k].val];
+        write_records(_runs_file.get(), sorted.data(), m);
+      }
+      _run_offsets.push_back(_run_offsets.back()+n);
+      _run.clear();
+    }
+
+    // Calls emit(record) for the records of runs [first,last) in (cell, corner) order,
+    // each run is read through a block of block records
+    template<typename Femit>
+    void merge(size_t first, size_t last, size_t block, Femit emit) {
+      struct run_reader
+      {
+        size_t pos, end;
+        std::vector<corner_record> block;
+        size_t next = 0;
+      };
+      std::vector<run_reader> readers(last-first);
+      auto refill = [&](size_t r) {
+                      auto &reader = readers[r];
+                      size_t n = std::min(block, reader.end-reader.pos);
+                      reader.block.resize(n);
+                      pread_records(_runs_file.get(), reader.block.data(), n, reader.pos);
+                      reader.pos += n;
+                      reader.next = 0;
+                      return n>0;
+                    };
+      auto greater = [&readers](size_t a, size_t b) {
+                       const auto &ra = readers[a].block[readers[a].next];
+                       const auto &rb = readers[b].block[readers[b].next];
+                       if (ra.cell!=rb.cell) return rb.cell<ra.cell;
+                       return rb.corner<ra.corner;
+                     };
+      std::priority_queue<size_t, std::vector<size_t>, decltype(greater)> heap(greater);
+      for (size_t r=0; r<readers.size(); r++) {
+        readers[r].pos = _run_offsets[first+r];
+        readers[r].end = _run_offsets[first+r+1];
+        if (refill(r))
+          heap.push(r);
+      }
+      while (!heap.empty()) {
+        size_t r = heap.top();
+        heap.pop();
+        emit(readers[r].block[readers[r].next]);
+        if (++readers[r].next<readers[r].block.size() || refill(r))
+          heap.push(r);
+      }
+    }
+
+    // Merges the runs in (cell, corner) order and writes every corner with the vertex of the
+    // first corner of its cell to its partition in placed.
+    // Half the memory is for the run blocks of min_block records at least, more runs than fit are
+    // first merged in passes. The other half pools the placed records, they are written grouped by
+    // partition. Beyond that only a record count per partition is kept.
+    void merge_runs(FILE *placed, size_t part_corners, size_t parts) {
+      trace_span span("merge runs");
+      std::fflush(_runs_file.get());
+      const size_t fan_in = std::max<size_t>(2, _max_memory/2/(min_block*sizeof(corner_record)));
+
+      // A merged run takes the place of the runs it merges
+      while (_run_offsets.size()-1>fan_in) {
+        trace_span pass("merge pass");
+        const size_t runs = _run_offsets.size()-1;
+        file_ptr merged = temp_file();
+        std::vector<size_t> offsets = {0};
+        std::vector<corner_record> out;
+        out.reserve(std::max<size_t>(1, _max_memory/2/sizeof(corner_record)));
+        for (size_t r=0; r<runs; r+=fan_in) {
+          const size_t last = std::min(runs, r+fan_in);
+          merge(r, last, _max_memory/2/(last-r)/sizeof(corner_record), [&](const corner_record &rec) {
+              out.push_back(rec);
+              if (out.size()==out.capacity()) {
+                write_records(merged.get(), out.data(), out.size());
+                out.clear();
+              }
+            });
+          write_records(merged.get(), out.data(), out.size());
+          out.clear();
+          offsets.push_back(_run_offsets[last]);
+        }
+        std::fflush(merged.get());
+        _runs_file = std::move(merged);
+        _run_offsets.swap(offsets);
+      }
+
+      std::vector<placed_record> pool;
+      pool.reserve(std::max<size_t>(1, _max_memory/2/sizeof(placed_record)));
+      std::vector<size_t> written(parts, 0);
+      auto flush = [&]() {
+                     std::sort(pool.begin(), pool.end(), [part_corners](const placed_record &a, const placed_record &b) {
+                         return a.corner/part_corners < b.corner/part_corners;
+                       });
+                     for (size_t i=0, j; i<pool.size(); i=j) {
+                       const size_t p = pool[i].corner/part_corners;
+                       for (j=i+1; j<pool.size() && pool[j].corner/part_corners==p; j++);
+                       pwrite_records(placed, pool.data()+i, j-i, p*part_corners+written[p]);
+                       written[p] += j-i;
+                     }
+                     pool.clear();
+                   };
+
+      bool first = true;
+      cell_t group_cell = {};
+      vertex_t group_vertex = {};
+      const size_t runs = _run_offsets.size()-1;
+      merge(0, runs, _max_memory/2/runs/sizeof(corner_record), [&](const corner_record &rec) {
+          if (first || rec.cell!=group_cell) {
+            group_cell = rec.cell;
+            group_vertex = rec.vertex;
+            first = false;
+          }
+          pool.push_back({ rec.corner, group_vertex });
+          if (pool.size()==pool.capacity())
+            flush();
+        });
+      flush();
+    }
+
+    double _fprec;
+    size_t _max_memory;
+    size_t _threads;
+    file_ptr _runs_file;
+    std::vector<corner_record> _run;
+    std::vector<size_t> _run_offsets = {0};
+    uint64_t _corners = 0;
+  };
+}
+
+#endif // EXTWELD_HPP
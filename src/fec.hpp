@@ -0,0 +1,365 @@
+// Copyright (C) 2019 hrobeers (https://github.com/hrobeers)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef FEC_HPP
+#define FEC_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#  include <immintrin.h>
+#  define STENOMESH_GF_SSSE3
+#endif
+
+#include "crc32c.hpp"
+
+namespace stenomesh {
+  // GF(2^8) arithmetic over the polynomial x^8+x^4+x^3+x^2+1
+  namespace gf256 {
+    struct tables_t
+    {
+      std::array<uint8_t,512> exp;
+      std::array<uint8_t,256> log;
+      std::array<std::array<uint8_t,256>,256> mul;
+    };
+
+    inline const tables_t& tables() {
+      static const tables_t *t = []() {
+                                   auto t = new tables_t();
+                                   unsigned x = 1;
+                                   for (int i=0; i<255; i++) {
+                                     t->exp[i] = t->exp[i+255] = uint8_t(x);
+                                     t->log[x] = uint8_t(i);
+                                     x <<= 1;
+                                     if (x & 0x100) x ^= 0x11d;
+                                   }
+                                   for (int a=1; a<256; a++)
+                                     for (int b=1; b<256; b++)
+                                       t->mul[a][b] = t->exp[t->log[a]+t->log[b]];
+                                   return t;
+                                 }();
+      return *t;
+    }
+
+    inline uint8_t mul(uint8_t a, uint8_t b) {
+      return tables().mul[a][b];
+    }
+
+    inline uint8_t inv(uint8_t a) {
+      return tables().exp[255-tables().log[a]];
+    }
+
+#ifdef STENOMESH_GF_SSSE3
+    // Products with c of the low and high nibbles, combined with two byte shuffles
+    __attribute__((target("ssse3")))
+    inline void mul_add_ssse3(uint8_t *dst, const uint8_t *src, uint8_t c, size_t n) {
+      const auto &row = tables().mul[c];
+      alignas(16) uint8_t lo[16], hi[16];
+      for (int i=0; i<16; i++) {
+        lo[i] = row[i];
+        hi[i] = row[i<<4];
+      }
+      const __m128i tlo = _mm_load_si128(reinterpret_cast<const __m128i*>(lo));
+      const __m128i thi = _mm_load_si128(reinterpret_cast<const __m128i*>(hi));
+      const __m128i mask = _mm_set1_epi8(0x0f);
+      for (size_t i=0; i<n; i+=16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src+i));
+        __m128i p = _mm_xor_si128(_mm_shuffle_epi8(tlo, _mm_and_si128(v, mask)),
+                                  _mm_shuffle_epi8(thi, _mm_and_si128(_mm_srli_epi64(v, 4), mask)));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst+i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+i), _mm_xor_si128(d, p));
+      }
+    }
+
+    inline bool has_ssse3() {
+      static const bool has = __builtin_cpu_supports("ssse3");
+      return has;
+    }
+#endif
+
+    // dst += c*src over n bytes, n a multiple of 16
+    inline void mul_add(uint8_t *dst, const uint8_t *src, uint8_t c, size_t n) {
+      if (c==0) return;
+#ifdef STENOMESH_GF_SSSE3
+      if (has_ssse3()) {
+        mul_add_ssse3(dst, src, c, n);
+        return;
+      }
+#endif
+      const auto &row = tables().mul[c];
+      for (size_t i=0; i<n; i++)
+        dst[i] ^= row[src[i]];
+    }
+  }
+
+  // Forward error correction of stored payload bytes.
+  // The bytes are cut in packets of fec_data_size, grouped in systematic Cauchy Reed-Solomon codewords
+  // of n packets of which k carry data, so any k intact packets of a group restore it.
+  // Packets carry their slot, the code parameters and a crc32c so they are found by scanning the
+  // attribute bytes for valid packets: facets dropped or moved only lose the packets they are part of.
+  // Slot j*G+g holds packet j of group g, spreading every group over the whole facet range.
+  //
+  // Packet layout, fec_packet_size bytes:
+  //   2 magic bytes, u8 n, u8 k, u32 slot, u32 stored size and flags, fec_data_size data bytes, u32 crc32c
+  const size_t fec_packet_size = 64;
+  const size_t fec_data_size = 48;
+  const size_t fec_header_size = 12;
+  const uint8_t fec_magic[2] = { 0x5e, 0xfe };
+
+  struct fec_code
+  {
+    size_t groups = 0; // G
+    size_t n = 0;      // packets per group
+    size_t k = 0;      // data packets per group
+  };
+
+  // Largest code with at least parity_percent parity packets that fits slots packets
+  // for data_packets data packets, groups is 0 when none fits
+  inline fec_code fec_plan(size_t data_packets, size_t slots, unsigned parity_percent) {
+    fec_code c;
+    data_packets = std::max<size_t>(data_packets, 1);
+    if (slots<2)
+      return c;
+    const size_t g0 = (slots+254)/255;
+    c.k = (data_packets+g0-1)/g0;
+    c.groups = (data_packets+c.k-1)/c.k;
+    c.n = std::min<size_t>(255, slots/c.groups);
+    const size_t parity = std::max<size_t>(1, (c.k*parity_percent+99)/100);
+    if (c.n<c.k+parity)
+      c.groups = 0;
+    return c;
+  }
+
+  // Stored bytes an fec encoding can hold in attr_bytes attribute bytes
+  inline size_t fec_capacity(size_t attr_bytes, unsigned parity_percent) {
+    const size_t slots = attr_bytes/fec_packet_size;
+    if (slots<2)
+      return 0;
+    const size_t g = (slots+254)/255;
+    const size_t n = std::min<size_t>(255, slots/g);
+    // Largest k leaving the requested parity
+    size_t k = n-1;
+    while (k>0 && k+std::max<size_t>(1, (k*parity_percent+99)/100)>n)
+      k--;
+    return g*k*fec_data_size;
+  }
+
+  namespace fec_detail {
+    // Row identifiers: data packet j is j, parity packet i is k+i
+    inline uint8_t cauchy(size_t k, size_t parity_row, size_t data_row) {
+      return gf256::inv(uint8_t((k+parity_row) ^ data_row));
+    }
+
+    inline void put32(uint8_t *p, uint32_t v) {
+      std::memcpy(p, &v, sizeof(v)); // TODO big endian support
+    }
+
+    inline uint32_t get32(const uint8_t *p) {
+      uint32_t v;
+      std::memcpy(&v, p, sizeof(v));
+      return v;
+    }
+
+    inline bool valid_packet(const uint8_t *p) {
+      return p[0]==fec_magic[0] && p[1]==fec_magic[1] && p[2]!=0 && p[3]!=0 && p[3]<p[2] &&
+        get32(p+fec_header_size+fec_data_size)==crc32c(p, fec_header_size+fec_data_size);
+    }
+  }
+
+  // Whether attr holds any packet
+  inline bool fec_packets(const std::string &attr) {
+    const uint8_t *src = reinterpret_cast<const uint8_t*>(attr.data());
+    for (size_t pos=0; pos+fec_packet_size<=attr.size(); pos+=2)
+      if (fec_detail::valid_packet(src+pos))
+        return true;
+    return false;
+  }
+
+  // The packets held by attr, one after the other
+  inline std::string fec_find_packets(const std::string &attr) {
+    const uint8_t *src = reinterpret_cast<const uint8_t*>(attr.data());
+    std::string packets;
+    for (size_t pos=0; pos+fec_packet_size<=attr.size(); ) {
+      if (!fec_detail::valid_packet(src+pos)) {
+        pos += 2;
+        continue;
+      }
+      packets.append(attr, pos, fec_packet_size);
+      pos += fec_packet_size;
+    }
+    return packets;
+  }
+
+  // Encodes stored (info holds its size and flags) into packets, filling at most attr_bytes.
+  // Returns the packet slots in order, empty when the code does not fit.
+  inline std::string fec_encode(const std::string &stored, uint32_t info, size_t attr_bytes, unsigned parity_percent) {
+    using namespace fec_detail;
+    const size_t data_packets = (stored.size()+fec_data_size-1)/fec_data_size;
+    const fec_code c = fec_plan(data_packets, attr_bytes/fec_packet_size, parity_percent);
+    if (!c.groups)
+      return std::string();
+
+    std::string out(c.groups*c.n*fec_packet_size, '\0');
+    uint8_t *const dst = reinterpret_cast<uint8_t*>(&out[0]);
+    std::vector<uint8_t> group(c.n*fec_data_size);
+    for (size_t g=0; g<c.groups; g++) {
+      std::fill(group.begin(), group.end(), 0);
+      for (size_t j=0; j<c.k; j++) {
+        const size_t begin = std::min(stored.size(), (g*c.k+j)*fec_data_size);
+        const size_t end = std::min(stored.size(), begin+fec_data_size);
+        std::memcpy(&group[j*fec_data_size], stored.data()+begin, end-begin);
+      }
+      for (size_t i=0; i<c.n-c.k; i++)
+        for (size_t j=0; j<c.k; j++)
+          gf256::mul_add(&group[(c.k+i)*fec_data_size], &group[j*fec_data_size], cauchy(c.k, i, j), fec_data_size);
+
+      for (size_t j=0; j<c.n; j++) {
+        const uint32_t slot = uint32_t(j*c.groups+g);
+        uint8_t *p = dst + slot*fec_packet_size;
+        p[0] = fec_magic[0];
+        p[1] = fec_magic[1];
+        p[2] = uint8_t(c.n);
+        p[3] = uint8_t(c.k);
+        put32(p+4, slot);
+        put32(p+8, info);
+        std::memcpy(p+fec_header_size, &group[j*fec_data_size], fec_data_size);
+        put32(p+fec_header_size+fec_data_size, crc32c(p, fec_header_size+fec_data_size));
+      }
+    }
+    return out;
+  }
+
+  namespace fec_detail {
+    // Data of the packets of the code found first in attr, by slot
+    struct found_packets
+    {
+      fec_code c;
+      uint32_t info = 0;
+      size_t stored_size = 0;
+      std::vector<const uint8_t*> slots;
+    };
+
+    // Scan facet by facet, skipping over each valid packet
+    inline found_packets scan(const std::string &attr, uint32_t length_mask) {
+      const uint8_t *src = reinterpret_cast<const uint8_t*>(attr.data());
+      found_packets f;
+      for (size_t pos=0; pos+fec_packet_size<=attr.size(); ) {
+        const uint8_t *p = src+pos;
+        if (!valid_packet(p)) {
+          pos += 2;
+          continue;
+        }
+        pos += fec_packet_size;
+        if (!f.c.groups) {
+          f.c.n = p[2];
+          f.c.k = p[3];
+          f.info = get32(p+8);
+          f.stored_size = f.info & length_mask;
+          const size_t data_packets = std::max<size_t>(1, (f.stored_size+fec_data_size-1)/fec_data_size);
+          f.c.groups = (data_packets+f.c.k-1)/f.c.k;
+          f.slots.assign(f.c.groups*f.c.n, nullptr);
+        }
+        const uint32_t slot = get32(p+4);
+        if (p[2]!=f.c.n || p[3]!=f.c.k || get32(p+8)!=f.info || slot>=f.slots.size() || f.slots[slot])
+          continue;
+        f.slots[slot] = p+fec_header_size;
+      }
+      return f;
+    }
+  }
+
+  // Whether attr holds every packet of its code
+  inline bool fec_complete(const std::string &attr, uint32_t length_mask) {
+    const auto f = fec_detail::scan(attr, length_mask);
+    return f.c.groups && std::find(f.slots.begin(), f.slots.end(), nullptr)==f.slots.end();
+  }
+
+  // Restores the stored bytes from the packets found in attr, info receives their size and flags
+  inline std::string fec_decode(const std::string &attr, uint32_t &info, uint32_t length_mask) {
+    using namespace fec_detail;
+    const found_packets f = scan(attr, length_mask);
+    const fec_code &c = f.c;
+    const size_t stored_size = f.stored_size;
+    const std::vector<const uint8_t*> &slots = f.slots;
+    if (!c.groups)
+      throw std::runtime_error("No payload packets found");
+    info = f.info;
+
+    std::string out(c.groups*c.k*fec_data_size, '\0');
+    uint8_t *const dst = reinterpret_cast<uint8_t*>(&out[0]);
+    std::vector<uint8_t> matrix;
+    std::vector<size_t> rows;
+    for (size_t g=0; g<c.groups; g++) {
+      auto packet = [&](size_t j) { return slots[j*c.groups+g]; };
+      uint8_t *group = dst + g*c.k*fec_data_size;
+
+      // Intact data packets are copied, the first intact parity packets replace lost ones
+      rows.clear();
+      std::vector<size_t> lost;
+      for (size_t j=0; j<c.k; j++)
+        if (packet(j)) {
+          std::memcpy(group+j*fec_data_size, packet(j), fec_data_size);
+          rows.push_back(j);
+        }
+        else
+          lost.push_back(j);
+      if (lost.empty())
+        continue;
+      for (size_t j=c.k; j<c.n && rows.size()<c.k; j++)
+        if (packet(j))
+          rows.push_back(j);
+      if (rows.size()<c.k)
+        throw std::runtime_error("Payload is damaged beyond repair");
+
+      // Invert the code rows of the intact packets by Gauss-Jordan elimination
+      const size_t k = c.k;
+      matrix.assign(2*k*k, 0);
+      auto a = [&](size_t r, size_t col) -> uint8_t& { return matrix[r*2*k+col]; };
+      for (size_t r=0; r<k; r++) {
+        for (size_t j=0; j<k; j++)
+          a(r, j) = rows[r]<k? uint8_t(rows[r]==j) : cauchy(k, rows[r]-k, j);
+        a(r, k+r) = 1;
+      }
+      for (size_t col=0; col<k; col++) {
+        size_t pivot = col;
+        while (a(pivot, col)==0) pivot++; // any k rows of a Cauchy code are independent
+        if (pivot!=col)
+          for (size_t j=0; j<2*k; j++) std::swap(a(pivot, j), a(col, j));
+        const uint8_t f = gf256::inv(a(col, col));
+        for (size_t j=0; j<2*k; j++) a(col, j) = gf256::mul(a(col, j), f);
+        for (size_t r=0; r<k; r++)
+          if (r!=col && a(r, col)) {
+            const uint8_t m = a(r, col);
+            for (size_t j=0; j<2*k; j++) a(r, j) ^= gf256::mul(m, a(col, j));
+          }
+      }
+
+      // Lost data packet j is row j of the inverse applied to the intact packets
+      for (size_t j : lost)
+        for (size_t r=0; r<k; r++)
+          gf256::mul_add(group+j*fec_data_size, packet(rows[r]), a(j, k+r), fec_data_size);
+    }
+    out.resize(std::min(out.size(), stored_size));
+    return out;
+  }
+}
+
+#endif // FEC_HPP
@@ -0,0 +1,65 @@
+// Copyright (C) 2019 hrobeers (https://github.com/hrobeers)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "libstenomesh.hpp"
+#include "memstream.hpp"
+#include "pipeline.hpp"
+
+namespace stenomesh {
+  void embed(std::string_view mesh, std::string_view payload, const options &opts, std::vector<char> &out) {
+    memory_istreambuf in_buf(mesh);
+    std::istream is(&in_buf);
+    out.clear();
+    vector_ostreambuf out_buf(out);
+    std::ostream os(&out_buf);
+    process(opts, is, [&](auto &m) {
+                        set_payload(m, std::string(payload), opts);
+                        if (opts.output==output_format::stl)
+                          out.reserve(84+triangle_count(m)*stl_record_size);
+                        write_output(m, os, opts);
+                      });
+  }
+
+  std::vector<char> embed(std::string_view mesh, std::string_view payload, const options &opts) {
+    std::vector<char> out;
+    embed(mesh, payload, opts, out);
+    return out;
+  }
+
+  std::string extract(std::string_view mesh, const options &opts) {
+    memory_istreambuf in_buf(mesh);
+    std::istream is(&in_buf);
+    options extract_opts;
+    extract_opts.key = opts.key;
+    extract_opts.scatter = opts.scatter;
+    extract_opts.lsb_bits = opts.lsb_bits;
+    extract_opts.lsb_normals = opts.lsb_normals;
+    return read_payload(extract_opts, is);
+  }
+
+  size_t capacity(std::string_view mesh, const options &opts) {
+    memory_istreambuf in_buf(mesh);
+    std::istream is(&in_buf);
+    uint64_t bytes = 0;
+    process(opts, is, [&](auto &m) { bytes = payload_capacity(m, opts); });
+    // Bytes of the output channel, minus the message length
+    if (bytes<=sizeof(uint32_t))
+      return 0;
+    if (opts.fec)
+      return std::min<size_t>(fec_capacity(std::min<size_t>(bytes-sizeof(uint32_t), payload_length_mask), opts.fec), payload_length_mask);
+    return std::min<size_t>(bytes-sizeof(uint32_t), payload_length_mask);
+  }
+}
@@ -0,0 +1,43 @@
+// Copyright (C) 2019 hrobeers (https://github.com/hrobeers)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef LIBSTENOMESH_HPP
+#define LIBSTENOMESH_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "options.hpp"
+
+// In-process API on memory buffers, no stdio and no global state.
+// Input meshes are binary or ascii STL or PLY, output meshes are binary STL, or binary PLY with opts.output.
+// Errors are reported as exceptions.
+namespace stenomesh {
+  // Writes mesh with payload encoded in the STL attribute bytes, and mantissa bits with opts.lsb_bits,
+  // or in the PLY steno property, to out, reusing its storage
+  void embed(std::string_view mesh, std::string_view payload, const options &opts, std::vector<char> &out);
+  std::vector<char> embed(std::string_view mesh, std::string_view payload, const options &opts = options());
+
+  // Payload encoded in the STL facets or PLY elements of mesh, laid out as by opts, opts.key decrypts encrypted payloads
+  std::string extract(std::string_view mesh, const options &opts = options());
+
+  // Stored payload bytes mesh can hold after processing with opts, net of the fec parity.
+  // Compressed payloads may hold more.
+  size_t capacity(std::string_view mesh, const options &opts = options());
+}
+
+#endif // LIBSTENOMESH_HPP
@@ -0,0 +1,161 @@
+// Copyright (C) 2019 hrobeers (https://github.com/hrobeers)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LSB_HPP
+#define LSB_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#  include <immintrin.h>
+#  define STENOMESH_LSB_BMI2
+#endif
+
+namespace stenomesh {
+  // Payload bits in the low mantissa bits of the floats of STL facet records.
+  // Bit strings are little endian, bit i is bit i%8 of byte i/8, and are read and written
+  // 8 bytes at a time, so buffers need 8 bytes of slack beyond the last bit.
+  const unsigned lsb_max_bits = 8; // per float, up to 96 bits per facet with normals
+
+  // n<=57 bits of src from bit on
+  inline uint64_t get_bits(const unsigned char *src, uint64_t bit, unsigned n) {
+    uint64_t v;
+    std::memcpy(&v, src+bit/8, sizeof(v)); // TODO big endian support
+    return (v >> (bit%8)) & ((uint64_t(1)<<n)-1);
+  }
+
+  // Ors n<=57 bits of v into dst from bit on, the bits are zero before
+  inline void or_bits(unsigned char *dst, uint64_t bit, uint64_t v) {
+    uint64_t w;
+    std::memcpy(&w, dst+bit/8, sizeof(w));
+    w |= v << (bit%8);
+    std::memcpy(dst+bit/8, &w, sizeof(w));
+  }
+
+  // Ors n bits of src from src_bit on into dst from dst_bit on
+  inline void copy_bits(unsigned char *dst, uint64_t dst_bit, const unsigned char *src, uint64_t src_bit, uint64_t n) {
+    for (uint64_t o=0; o<n; o+=56) {
+      const unsigned m = unsigned(std::min<uint64_t>(56, n-o));
+      or_bits(dst, dst_bit+o, get_bits(src, src_bit+o, m));
+    }
+  }
+
+  namespace lsb_detail {
+    // Both floats of a little endian pair
+    inline uint64_t pair_mask(unsigned k) {
+      return ((uint64_t(1)<<k)-1) * 0x100000001ull;
+    }
+
+    inline void embed_scalar(unsigned char *f, unsigned n, unsigned k, const unsigned char *bits) {
+      const uint32_t m = (uint32_t(1)<<k)-1;
+      for (unsigned i=0; i<n; i++) {
+        uint32_t w;
+        std::memcpy(&w, f+4*i, sizeof(w));
+        w = (w & ~m) | uint32_t(get_bits(bits, i*k, k));
+        std::memcpy(f+4*i, &w, sizeof(w));
+      }
+    }
+
+    inline void extract_scalar(const unsigned char *f, unsigned n, unsigned k, unsigned char *bits) {
+      const uint32_t m = (uint32_t(1)<<k)-1;
+      for (unsigned i=0; i<n; i++) {
+        uint32_t w;
+        std::memcpy(&w, f+4*i, sizeof(w));
+        or_bits(bits, i*k, w & m);
+      }
+    }
+
+#ifdef STENOMESH_LSB_BMI2
+    // A pair of floats per deposit or extract, the odd float is done alone
+    __attribute__((target("bmi2")))
+    inline void embed_bmi2(unsigned char *f, unsigned n, unsigned k, const unsigned char *bits) {
+      const uint64_t m = pair_mask(k);
+      unsigned i = 0;
+      for (; i+2<=n; i+=2) {
+        uint64_t w;
+        std::memcpy(&w, f+4*i, sizeof(w));
+        w = (w & ~m) | _pdep_u64(get_bits(bits, i*k, 2*k), m);
+        std::memcpy(f+4*i, &w, sizeof(w));
+      }
+      if (i<n) {
+        uint32_t w;
+        std::memcpy(&w, f+4*i, sizeof(w));
+        w = (w & ~uint32_t(m)) | uint32_t(get_bits(bits, i*k, k));
+        std::memcpy(f+4*i, &w, sizeof(w));
+      }
+    }
+
+    __attribute__((target("bmi2")))
+    inline void extract_bmi2(const unsigned char *f, unsigned n, unsigned k, unsigned char *bits) {
+      const uint64_t m = pair_mask(k);
+      unsigned i = 0;
+      for (; i+2<=n; i+=2) {
+        uint64_t w;
+        std::memcpy(&w, f+4*i, sizeof(w));
+        or_bits(bits, i*k, _pext_u64(w, m));
+      }
+      if (i<n) {
+        uint32_t w;
+        std::memcpy(&w, f+4*i, sizeof(w));
+        or_bits(bits, i*k, w & ((uint32_t(1)<<k)-1));
+      }
+    }
+
+    inline bool has_bmi2() {
+      static const bool has = __builtin_cpu_supports("bmi2");
+      return has;
+    }
+#endif
+  }
+
+  // Replaces the k low mantissa bits of the n little endian floats at f by n fields of k bits
+  inline void lsb_embed(unsigned char *f, unsigned n, unsigned k, const unsigned char *bits) {
+#ifdef STENOMESH_LSB_BMI2
+    if (lsb_detail::has_bmi2())
+      return lsb_detail::embed_bmi2(f, n, k, bits);
+#endif
+    lsb_detail::embed_scalar(f, n, k, bits);
+  }
+
+  // Ors the k low mantissa bits of the n floats at f as n fields of k bits into zeroed bits
+  inline void lsb_extract(const unsigned char *f, unsigned n, unsigned k, unsigned char *bits) {
+#ifdef STENOMESH_LSB_BMI2
+    if (lsb_detail::has_bmi2())
+      return lsb_detail::extract_bmi2(f, n, k, bits);
+#endif
+    lsb_detail::extract_scalar(f, n, k, bits);
+  }
+
+  // Largest distance a vertex within bbox moves when its coordinates carry k bits each
+  template<typename Tbbox>
+  double lsb_error_bound(const Tbbox &bbox, unsigned k) {
+    double sum = 0;
+    for (size_t a=0; a<3; a++) {
+      const double m = std::max(std::fabs(double(bbox[0][a])), std::fabs(double(bbox[1][a])));
+      int e;
+      std::frexp(m, &e);
+      const double ulp = std::ldexp(1.0, std::max(e, -125)-24); // float spacing below 2^e
+      const double err = ulp*double((uint32_t(1)<<k)-1);
+      sum += err*err;
+    }
+    return std::sqrt(sum);
+  }
+}
+
+#endif // LSB_HPP
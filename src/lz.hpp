@@ -0,0 +1,192 @@
+// Copyright (C) 2019 hrobeers (https://github.com/hrobeers)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LZ_HPP
+#define LZ_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace stenomesh {
+  // Byte oriented LZ77 in the LZ4 block layout: sequences of a token (literal count, match length - 4),
+  // the literals, a 2 byte little endian match offset and length extension bytes of 255.
+  // The last sequence holds literals only. Matches are found greedily through a hash of 4 byte sequences.
+  namespace lz {
+    const size_t min_match = 4;
+    const size_t last_literals = 5;  // the input ends with literals
+    const size_t match_limit = 12;   // no match starts in the last bytes
+    const size_t max_offset = 65535;
+    const int hash_bits = 14;
+
+    inline uint32_t read32(const unsigned char *p) {
+      uint32_t v;
+      std::memcpy(&v, p, sizeof(v));
+      return v;
+    }
+
+    inline uint32_t hash(uint32_t seq) {
+      return (seq*2654435761u) >> (32-hash_bits);
+    }
+
+    inline unsigned char* put_length(unsigned char *op, size_t len) {
+      for (; len>=255; len-=255)
+        *op++ = 255;
+      *op++ = (unsigned char)len;
+      return op;
+    }
+
+    // Copies n bytes in 16 byte steps, writing and reading up to 15 bytes beyond
+    inline void wild_copy(void *dst, const void *src, size_t n) {
+      char *d = static_cast<char*>(dst);
+      const char *s = static_cast<const char*>(src);
+      for (char *e = d+n; d<e; d+=16, s+=16)
+        std::memcpy(d, s, 16);
+    }
+
+    // Appends a sequence at op, match_len 0 for the final literals.
+    // wild allows reading 15 bytes beyond the literals.
+    inline unsigned char* put_sequence(unsigned char *op, const unsigned char *literals, size_t n_literals, size_t offset, size_t match_len, bool wild) {
+      const size_t ml = match_len? match_len-min_match : 0;
+      *op++ = (unsigned char)((std::min<size_t>(n_literals, 15) << 4) | std::min<size_t>(ml, 15));
+      if (n_literals>=15)
+        op = put_length(op, n_literals-15);
+      if (wild)
+        wild_copy(op, literals, n_literals);
+      else
+        std::memcpy(op, literals, n_literals);
+      op += n_literals;
+      if (!match_len)
+        return op;
+      *op++ = (unsigned char)(offset & 0xff);
+      *op++ = (unsigned char)(offset >> 8);
+      if (ml>=15)
+        op = put_length(op, ml-15);
+      return op;
+    }
+
+    // Length of the common prefix of a and b, up to limit bytes
+    inline size_t common_length(const unsigned char *a, const unsigned char *b, size_t limit) {
+      size_t len = 0;
+      while (len+8<=limit) {
+        uint64_t x, y;
+        std::memcpy(&x, a+len, 8);
+        std::memcpy(&y, b+len, 8);
+        if (x!=y)
+          return len + (__builtin_ctzll(x^y) >> 3); // TODO big endian support
+        len += 8;
+      }
+      while (len<limit && a[len]==b[len])
+        len++;
+      return len;
+    }
+  }
+
+  inline std::string lz_compress(std::string_view in) {
+    using namespace lz;
+    const unsigned char *src = reinterpret_cast<const unsigned char*>(in.data());
+    const size_t n = in.size();
+    std::string out(n + n/255 + 32, '\0'); // worst case, all literals, and wild copy slack
+    unsigned char *const dst = reinterpret_cast<unsigned char*>(out.data());
+    unsigned char *op = dst;
+
+    size_t anchor = 0;
+    if (n>match_limit) {
+      std::vector<uint32_t> table(size_t(1)<<hash_bits, 0); // position+1 of the last sequence per hash
+      size_t ip = 0;
+      size_t misses = 0;
+      while (ip+match_limit<n) {
+        const uint32_t seq = read32(src+ip);
+        uint32_t &slot = table[hash(seq)];
+        const size_t ref = slot;
+        slot = uint32_t(ip+1);
+        if (ref && ip+1-ref<=max_offset && read32(src+ref-1)==seq) {
+          const size_t match_len = min_match + common_length(src+ip+min_match, src+ref-1+min_match, n-last_literals-ip-min_match);
+          op = put_sequence(op, src+anchor, ip-anchor, ip+1-ref, match_len, ip+16<=n);
+          ip += match_len;
+          anchor = ip;
+          misses = 0;
+        }
+        else
+          // Skip faster through incompressible data
+          ip += 1 + (misses++ >> 5);
+      }
+    }
+    op = put_sequence(op, src+anchor, n-anchor, 0, 0, false);
+    out.resize(op-dst);
+    return out;
+  }
+
+  // Throws when in is not a valid block of exactly size decompressed bytes
+  inline std::string lz_decompress(std::string_view in, size_t size) {
+    using namespace lz;
+    const unsigned char *ip = reinterpret_cast<const unsigned char*>(in.data());
+    const unsigned char *const end = ip+in.size();
+    const size_t slack = 32; // room for wild copies
+    std::string out(size+slack, '\0');
+    char *const dst = out.data();
+    size_t op = 0;
+
+    auto corrupt = []() { return std::runtime_error("Corrupt compressed payload"); };
+    auto get_length = [&](size_t len) {
+                        if (len<15) return len;
+                        unsigned char b;
+                        do {
+                          if (ip>=end) throw corrupt();
+                          b = *ip++;
+                          len += b;
+                        } while (b==255);
+                        return len;
+                      };
+
+    while (true) {
+      if (ip>=end) throw corrupt();
+      const unsigned char token = *ip++;
+      const size_t n_literals = get_length(token >> 4);
+      if (n_literals>size_t(end-ip) || n_literals>size-op) throw corrupt();
+      if (n_literals+16<=size_t(end-ip))
+        wild_copy(dst+op, ip, n_literals);
+      else
+        std::memcpy(dst+op, ip, n_literals);
+      ip += n_literals;
+      op += n_literals;
+      if (ip==end)
+        break;
+
+      if (end-ip<2) throw corrupt();
+      const size_t offset = ip[0] | (size_t(ip[1]) << 8);
+      ip += 2;
+      const size_t match_len = get_length(token & 0xf) + min_match;
+      if (offset==0 || offset>op || match_len>size-op) throw corrupt();
+      const char *match = dst+op-offset;
+      if (offset>=16)
+        wild_copy(dst+op, match, match_len);
+      else if (offset>=match_len)
+        std::memcpy(dst+op, match, match_len);
+      else
+        for (size_t i=0; i<match_len; i++) // overlapping copy repeats the last offset bytes
+          dst[op+i] = match[i];
+      op += match_len;
+    }
+    if (op!=size) throw corrupt();
+    out.resize(size);
+    return out;
+  }
+}
+
+#endif // LZ_HPP
@@ -0,0 +1,74 @@
+// Copyright (C) 2019 hrobeers (https://github.com/hrobeers)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef MEMSTREAM_HPP
+#define MEMSTREAM_HPP
+
+#include <streambuf>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+
+namespace stenomesh {
+  // Seekable read-only streambuf over a memory buffer, no copies
+  class memory_istreambuf : public std::streambuf
+  {
+  public:
+    explicit memory_istreambuf(std::string_view data) {
+      char *begin = const_cast<char*>(data.data());
+      setg(begin, begin, begin+data.size());
+    }
+
+  protected:
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override {
+      if (!(which & std::ios_base::in))
+        return pos_type(off_type(-1));
+      off_type base = dir==std::ios_base::beg? 0 : dir==std::ios_base::cur? gptr()-eback() : egptr()-eback();
+      return seekpos(pos_type(base+off), which);
+    }
+
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override {
+      if (!(which & std::ios_base::in) || off_type(pos)<0 || off_type(pos)>egptr()-eback())
+        return pos_type(off_type(-1));
+      setg(eback(), eback()+off_type(pos), egptr());
+      return pos;
+    }
+  };
+
+  // Write-only streambuf appending to a vector, which can be reused between writes
+  class vector_ostreambuf : public std::streambuf
+  {
+  public:
+    explicit vector_ostreambuf(std::vector<char> &out) : _out(out) {}
+
+  protected:
+    int_type overflow(int_type ch) override {
+      if (ch!=traits_type::eof())
+        _out.push_back(traits_type::to_char_type(ch));
+      return traits_type::not_eof(ch);
+    }
+
+    std::streamsize xsputn(const char *s, std::streamsize n) override {
+      _out.insert(_out.end(), s, s+n);
+      return n;
+    }
+
+  private:
+    std::vector<char> &_out;
+  };
+}
+
+#endif // MEMSTREAM_HPP
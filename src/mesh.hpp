@@ -19,6 +19,8 @@
 
 #include <array>
 #include <vector>
+#include <string>
+#include <cstdint>
 #include <unistd.h>
 
 namespace stenomesh {
@@ -32,8 +34,30 @@ namespace stenomesh {
 
     vertices_t vertices;
     faces_t faces;
+    std::vector<std::array<float_t,3>> normals; // input face normals, empty unless kept
     std::string comment;
     std::string steno_msg;
+    uint32_t steno_flags = 0; // payload encoding, see payload.hpp
+  };
+
+  // Polygon mesh with faces in compressed row storage:
+  // face i uses vertices face_indices[face_offsets[i]] up to face_indices[face_offsets[i+1]]
+  template<typename Tfloat = float, typename Tidx = uint32_t>
+  struct PolyMesh
+  {
+    typedef Tfloat float_t;
+    typedef Tidx idx_t;
+    typedef std::vector<std::array<float_t,3>> vertices_t;
+
+    vertices_t vertices;
+    std::vector<size_t> face_offsets = {0};
+    std::vector<idx_t> face_indices;
+    std::string comment;
+    std::string steno_msg;
+    uint32_t steno_flags = 0; // payload encoding, see payload.hpp
+
+    size_t face_count() const { return face_offsets.size()-1; }
+    size_t face_size(size_t i) const { return face_offsets[i+1]-face_offsets[i]; }
   };
 }
 
@@ -4,7 +4,14 @@
 
 #include <map>
 #include <algorithm>
+#include <limits>
+#include <cstring>
+#include <type_traits>
+#include <cmath>
+#include <stdexcept>
 #include "mesh.hpp"
+#include "options.hpp"
+#include "radixsort.hpp"
 
 namespace stenomesh {
   template<typename Tarr>
@@ -14,6 +21,12 @@ namespace stenomesh {
     return (pos == std::end(arr));
   }
 
+  // Branchless check for triangles
+  template<typename T>
+  bool all_distinct(const std::array<T,3> &arr) {
+    return (arr[0]!=arr[1]) & (arr[1]!=arr[2]) & (arr[0]!=arr[2]);
+  }
+
   template<typename Tarr_in, typename Tarr_out>
   Tarr_out multiply(const Tarr_in &array, double factor) {
     Tarr_out out;
@@ -22,30 +35,365 @@ namespace stenomesh {
     return out;
   }
 
+  // Index of a vertex appended to vertices, the max index value is reserved
+  template<typename Tidx>
+  Tidx next_index(size_t size) {
+    if (size >= std::numeric_limits<Tidx>::max())
+      throw std::overflow_error("Vertex count exceeds the index type");
+    return Tidx(size);
+  }
+
   template<typename vertices_t, typename dup_map_t>
-  uint32_t dedup_insert(typename vertices_t::value_type new_vertex, vertices_t &vertices , dup_map_t &duplicates, double fprec) {
+  typename dup_map_t::mapped_type dedup_insert(typename vertices_t::value_type new_vertex, vertices_t &vertices , dup_map_t &duplicates, double fprec) {
     auto va = multiply<typename vertices_t::value_type, typename dup_map_t::key_type>(new_vertex, fprec);
     auto dup_search = duplicates.find(va);
     if (dup_search != duplicates.end())
       return dup_search->second;
 
-    uint32_t new_idx = vertices.size();
+    auto new_idx = next_index<typename dup_map_t::mapped_type>(vertices.size());
     duplicates[va] = new_idx;
     vertices.push_back(new_vertex);
     return new_idx;
   }
 
+  // Inserters map a vertex to its index in the vertex list, appending it if new.
+  // Inserters that weld may map different vertices to the same index.
+  template<typename TMesh>
+  struct append_inserter
+  {
+    static constexpr bool welds = false;
+
+    void reserve(size_t) {}
+
+    typename TMesh::idx_t operator()(typename TMesh::vertices_t &vertices, const typename TMesh::vertices_t::value_type &vertex) {
+      auto new_idx = next_index<typename TMesh::idx_t>(vertices.size());
+      vertices.push_back(vertex);
+      return new_idx;
+    }
+  };
+
+  // Quantizing welder: merges vertices truncating to the same 1/dist grid cell
+  template<typename TMesh>
+  struct map_welder
+  {
+    static constexpr bool welds = true;
+    std::map<std::array<ssize_t,3>, typename TMesh::idx_t> duplicates;
+    double fprec;
+
+    map_welder(double dist) : fprec(1/dist) {}
+
+    void reserve(size_t) {}
+
+    typename TMesh::idx_t operator()(typename TMesh::vertices_t &vertices, const typename TMesh::vertices_t::value_type &vertex) {
+      return dedup_insert(vertex, vertices, duplicates, fprec);
+    }
+  };
+
+  // Float bit pattern with -0.0 folded onto +0.0
+  template<typename Tfloat>
+  auto float_bits(Tfloat f) {
+    typename std::conditional<sizeof(Tfloat)==4, uint32_t, uint64_t>::type bits = 0;
+    if (f!=0)
+      std::memcpy(&bits, &f, sizeof(f));
+    return bits;
+  }
+
+  // Exact welder: merges vertices with identical coordinate bit patterns (dist==0).
+  // Open addressing hash table of welded vertex indices with linear probing.
+  template<typename TMesh>
+  class exact_welder
+  {
+    typedef typename TMesh::idx_t idx_t;
+    typedef typename TMesh::vertices_t vertices_t;
+    typedef typename vertices_t::value_type vertex_t;
+    static constexpr idx_t empty = std::numeric_limits<idx_t>::max();
+
+  public:
+    static constexpr bool welds = true;
+
+  private:
+    std::vector<idx_t> table;
+    size_t count = 0;
+
+    static uint64_t hash(const vertex_t &v) {
+      uint64_t h = 0x9e3779b97f4a7c15ull;
+      for (auto c : v) {
+        h ^= float_bits(c);
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+      }
+      return h;
+    }
+
+    static bool equal(const vertex_t &a, const vertex_t &b) {
+      for (size_t i=0; i<a.size(); i++)
+        if (float_bits(a[i])!=float_bits(b[i])) return false;
+      return true;
+    }
+
+    void grow(const vertices_t &vertices) {
+      std::vector<idx_t> old(std::max<size_t>(64, table.size()*2), empty);
+      old.swap(table);
+      size_t mask = table.size()-1;
+      for (auto idx : old)
+        if (idx!=empty) {
+          size_t pos = hash(vertices[idx]) & mask;
+          while (table[pos]!=empty) pos = (pos+1) & mask;
+          table[pos] = idx;
+        }
+    }
+
+  public:
+    // Table is sized for size_hint unique vertices upfront
+    exact_welder(size_t size_hint = 0) {
+      table.assign(64, empty);
+      reserve(size_hint);
+    }
+
+    void reserve(size_t size_hint) {
+      if (count || table.size() >= 2*size_hint) return;
+      size_t capacity = table.size();
+      while (capacity < 2*size_hint) capacity*=2;
+      table.assign(capacity, empty);
+    }
+
+    idx_t operator()(vertices_t &vertices, const vertex_t &vertex) {
+      size_t mask = table.size()-1;
+      size_t pos = hash(vertex) & mask;
+      for (; table[pos]!=empty; pos = (pos+1) & mask)
+        if (equal(vertices[table[pos]], vertex))
+          return table[pos];
+
+      idx_t new_idx = next_index<idx_t>(vertices.size());
+      vertices.push_back(vertex);
+      table[pos] = new_idx;
+      if (2*++count > table.size())
+        grow(vertices);
+      return new_idx;
+    }
+
+    // Index of a welded vertex, or max() when it is not, safe to call from several threads
+    idx_t find(const vertices_t &vertices, const vertex_t &vertex) const {
+      size_t mask = table.size()-1;
+      for (size_t pos = hash(vertex) & mask; table[pos]!=empty; pos = (pos+1) & mask)
+        if (equal(vertices[table[pos]], vertex))
+          return table[pos];
+      return empty;
+    }
+  };
+
+  // Radius welder: merges a vertex into the first welded vertex within dist of it.
+  // Welded vertices are binned in a uniform grid of 2*dist sized cells (open addressing
+  // hash on the cell), so a lookup only visits the 8 cells overlapping the search sphere.
+  // Vertices never merge transitively, welded vertices are at least dist apart.
+  template<typename TMesh>
+  class grid_welder
+  {
+    typedef typename TMesh::idx_t idx_t;
+    typedef typename TMesh::vertices_t vertices_t;
+    typedef typename vertices_t::value_type vertex_t;
+    typedef std::array<int64_t,3> cell_t;
+    static constexpr idx_t empty = std::numeric_limits<idx_t>::max();
+
+  public:
+    static constexpr bool welds = true;
+
+  private:
+    struct slot
+    {
+      cell_t cell;
+      idx_t head;
+    };
+
+    std::vector<slot> table;
+    std::vector<idx_t> next; // next welded vertex in the same cell
+    size_t count = 0;
+    double dist, inv_dist;
+
+    static uint64_t hash(const cell_t &c) {
+      uint64_t h = uint64_t(c[0])*0x9e3779b97f4a7c15ull ^ uint64_t(c[1])*0xc2b2ae3d27d4eb4full ^ uint64_t(c[2])*0x165667b19e3779f9ull;
+      h ^= h >> 33;
+      h *= 0xff51afd7ed558ccdull;
+      return h ^ h >> 33;
+    }
+
+    slot& find(const cell_t &c) {
+      size_t mask = table.size()-1;
+      size_t pos = hash(c) & mask;
+      while (table[pos].head!=empty && table[pos].cell!=c) pos = (pos+1) & mask;
+      return table[pos];
+    }
+
+    void grow() {
+      std::vector<slot> old(table.size()*2, slot{{0,0,0}, empty});
+      old.swap(table);
+      for (const auto &s : old)
+        if (s.head!=empty) find(s.cell) = s;
+    }
+
+  public:
+    grid_welder(double dist, size_t size_hint = 0) : dist(dist), inv_dist(0.5/dist) {
+      table.assign(64, slot{{0,0,0}, empty});
+      reserve(size_hint);
+    }
+
+    void reserve(size_t size_hint) {
+      next.reserve(size_hint);
+      if (count || table.size() >= 2*size_hint) return;
+      size_t capacity = table.size();
+      while (capacity < 2*size_hint) capacity*=2;
+      table.assign(capacity, slot{{0,0,0}, empty});
+    }
+
+    idx_t operator()(vertices_t &vertices, const vertex_t &vertex) {
+      cell_t cell, side;
+      for (size_t i=0; i<3; i++) {
+        double pos = vertex[i]*inv_dist;
+        cell[i] = (int64_t)std::floor(pos);
+        side[i] = pos-cell[i] < 0.5? -1 : 1;
+      }
+
+      idx_t first = empty;
+      const double max_dist2 = dist*dist;
+      for (size_t n=0; n<8; n++) {
+        cell_t neighbor = { cell[0] + (n&1? side[0]:0), cell[1] + (n&2? side[1]:0), cell[2] + (n&4? side[2]:0) };
+        for (idx_t idx = find(neighbor).head; idx!=empty; idx = next[idx]) {
+          if (idx>=first) continue;
+          double dist2 = 0;
+          for (size_t i=0; i<3; i++) {
+            double d = double(vertices[idx][i]) - double(vertex[i]);
+            dist2 += d*d;
+          }
+          if (dist2<=max_dist2) first = idx;
+        }
+      }
+      if (first!=empty)
+        return first;
+
+      idx_t new_idx = next_index<idx_t>(vertices.size());
+      vertices.push_back(vertex);
+      slot &s = find(cell);
+      next.push_back(s.head);
+      if (s.head==empty) {
+        s.cell = cell;
+        count++;
+      }
+      s.head = new_idx;
+      if (2*count > table.size())
+        grow();
+      return new_idx;
+    }
+  };
+
+  // Adds a face through insert, dropping it if welding collapsed it
+  template<typename TMesh, typename Tinserter, typename Tface_vertices>
+  void insert_face(TMesh &mesh, Tinserter &insert, const Tface_vertices &face_vertices) {
+    typename TMesh::faces_t::value_type new_face;
+    size_t i = 0;
+    for (const auto &vertex : face_vertices)
+      new_face[i++] = insert(mesh.vertices, vertex);
+    if (!Tinserter::welds || all_distinct(new_face))
+      mesh.faces.push_back(new_face);
+  }
+
+  // Rebuilds the vertex list through welder, dropping faces that collapse
+  template<typename TMesh, typename Twelder>
+  void vertex_merge_with(TMesh &mesh, Twelder &&welder) {
+    TMesh welded;
+    std::array<typename TMesh::vertices_t::value_type, std::tuple_size<typename TMesh::faces_t::value_type>::value> face_vertices;
+    for (const auto &face : mesh.faces) {
+      size_t i = 0;
+      for (auto vtx_idx : face)
+        face_vertices[i++] = mesh.vertices[vtx_idx];
+      insert_face(welded, welder, face_vertices);
+    }
+    mesh.faces.swap(welded.faces);
+    mesh.vertices.swap(welded.vertices);
+  }
+
+  // Interleaves the low 21 bits of x, y and z into a 63 bit Z-order code
+  inline uint64_t morton_code(uint64_t x, uint64_t y, uint64_t z) {
+    auto spread = [](uint64_t v) {
+                    v &= 0x1fffff;
+                    v = (v | v << 32) & 0x1f00000000ffffull;
+                    v = (v | v << 16) & 0x1f0000ff0000ffull;
+                    v = (v | v << 8)  & 0x100f00f00f00f00full;
+                    v = (v | v << 4)  & 0x10c30c30c30c30c3ull;
+                    v = (v | v << 2)  & 0x1249249249249249ull;
+                    return v;
+                  };
+    return spread(x) | spread(y) << 1 | spread(z) << 2;
+  }
+
+  // Sort based equivalent of vertex_merge_with(mesh, map_welder<TMesh>(dist)).
+  // Vertices are keyed on the Morton code of their quantized coordinates and radix sorted,
+  // equal runs form the welded groups. Welded indices follow first use by the faces,
+  // so the output is identical to the map based merge.
   template<typename TMesh>
-  void vertex_merge(TMesh &mesh, double dist = 1/1e2) {
-    std::map<std::array<ssize_t,3>, typename TMesh::idx_t> merge_map;
+  void vertex_merge_sorted(TMesh &mesh, double dist, size_t threads = 1) {
+    typedef typename TMesh::idx_t idx_t;
+    typedef std::array<ssize_t,3> cell_t;
+    const double fprec = 1/dist;
+    const size_t n = mesh.vertices.size();
+    if (n==0) return;
+
+    std::vector<cell_t> cells(n);
+    parallel_for(n, threads, [&](size_t begin, size_t end) {
+                               for (size_t i=begin; i<end; i++)
+                                 cells[i] = multiply<typename TMesh::vertices_t::value_type, cell_t>(mesh.vertices[i], fprec);
+                             });
+    cell_t lo = cells.front(), hi = cells.front();
+    for (const auto &c : cells)
+      for (size_t i=0; i<3; i++) {
+        lo[i] = std::min(lo[i], c[i]);
+        hi[i] = std::max(hi[i], c[i]);
+      }
 
+    // Keys not fitting a Morton code are sorted axis by axis
+    std::vector<keyed<idx_t>> items(n);
+    bool morton = true;
+    for (size_t i=0; i<3; i++)
+      morton &= size_t(hi[i]-lo[i]) < (size_t(1)<<21);
+    auto sort_on = [&](auto key, bool init) {
+                     parallel_for(n, threads, [&](size_t begin, size_t end) {
+                                                for (size_t i=begin; i<end; i++) {
+                                                  idx_t v = init? idx_t(i) : items[i].val;
+                                                  items[i] = { key(cells[v]), v };
+                                                }
+                                              });
+                     radix_sort(items, threads);
+                   };
+    if (morton)
+      sort_on([&lo](const cell_t &c) { return morton_code(c[0]-lo[0], c[1]-lo[1], c[2]-lo[2]); }, true);
+    else
+      for (size_t i=3; i-->0;)
+        sort_on([&lo, i](const cell_t &c) { return uint64_t(c[i]-lo[i]); }, i==2);
+
+    // Collapse equal runs into groups
+    std::vector<idx_t> group(n);
+    idx_t groups = 0;
+    for (size_t i=0; i<n; i++) {
+      if (i>0 && cells[items[i].val]!=cells[items[i-1].val]) groups++;
+      group[items[i].val] = groups;
+    }
+    items = std::vector<keyed<idx_t>>();
+
+    // Number the groups in order of first use
+    const idx_t unused = std::numeric_limits<idx_t>::max();
+    std::vector<idx_t> welded(size_t(groups)+1, unused);
     typename TMesh::faces_t new_faces;
     typename TMesh::vertices_t new_vertices;
-    for (auto face : mesh.faces) {
+    for (const auto &face : mesh.faces) {
       typename TMesh::faces_t::value_type new_face;
       size_t i = 0;
-      for (auto vtx_idx : face)
-        new_face[i++] = dedup_insert(mesh.vertices[vtx_idx], new_vertices, merge_map, 1/dist);
+      for (auto vtx_idx : face) {
+        idx_t &w = welded[group[vtx_idx]];
+        if (w==unused) {
+          w = new_vertices.size();
+          new_vertices.push_back(mesh.vertices[vtx_idx]);
+        }
+        new_face[i++] = w;
+      }
       if (all_distinct(new_face))
         new_faces.push_back(new_face);
     }
@@ -53,6 +401,85 @@ namespace stenomesh {
     mesh.vertices.swap(new_vertices);
   }
 
+  // dist==0 only merges exact duplicates, for any strategy
+  template<typename TMesh>
+  void vertex_merge(TMesh &mesh, double dist = 1/1e2, weld_strategy strategy = weld_strategy::map, size_t threads = 1) {
+    if (dist==0)
+      vertex_merge_with(mesh, exact_welder<TMesh>(mesh.vertices.size()/4));
+    else if (strategy==weld_strategy::sort)
+      vertex_merge_sorted(mesh, dist, threads);
+    else if (strategy==weld_strategy::grid)
+      vertex_merge_with(mesh, grid_welder<TMesh>(dist, mesh.vertices.size()/4));
+    else
+      vertex_merge_with(mesh, map_welder<TMesh>(dist));
+  }
+
+  // Triangle access for writers, faces with more vertices are fanned around their first vertex
+  template<size_t N, typename Tfloat, typename Tidx>
+  size_t triangle_count(const Mesh<N, Tfloat, Tidx> &mesh) {
+    return mesh.faces.size()*(N-2);
+  }
+
+  template<typename Tfloat, typename Tidx>
+  size_t triangle_count(const PolyMesh<Tfloat, Tidx> &mesh) {
+    return mesh.face_indices.size() - 2*mesh.face_count();
+  }
+
+  // Input normals per triangle, nullptr if not kept or no longer matching the faces
+  template<size_t N, typename Tfloat, typename Tidx>
+  const std::array<Tfloat,3>* input_normals(const Mesh<N, Tfloat, Tidx> &mesh) {
+    return N==3 && !mesh.normals.empty() && mesh.normals.size()==mesh.faces.size()? mesh.normals.data() : nullptr;
+  }
+
+  template<typename Tfloat, typename Tidx>
+  const std::array<Tfloat,3>* input_normals(const PolyMesh<Tfloat, Tidx> &) {
+    return nullptr;
+  }
+
+  // Calls f(triangle) for the triangles [begin,end) in face order
+  template<size_t N, typename Tfloat, typename Tidx, typename F>
+  void for_each_triangle(const Mesh<N, Tfloat, Tidx> &mesh, size_t begin, size_t end, F f) {
+    for (size_t t=begin; t<end; t++) {
+      const auto &face = mesh.faces[t/(N-2)];
+      size_t k = t%(N-2);
+      f(std::array<Tidx,3>{ face[0], face[k+1], face[k+2] });
+    }
+  }
+
+  template<typename Tfloat, typename Tidx, typename F>
+  void for_each_triangle(const PolyMesh<Tfloat, Tidx> &mesh, size_t begin, size_t end, F f) {
+    if (begin>=end) return;
+    // faces before face i hold face_offsets[i]-2*i triangles, find the face holding triangle begin
+    size_t i = 0, hi = mesh.face_count();
+    while (hi-i > 1) {
+      size_t mid = (i+hi)/2;
+      if (mesh.face_offsets[mid]-2*mid <= begin) i = mid;
+      else hi = mid;
+    }
+    size_t k = begin - (mesh.face_offsets[i]-2*i);
+    for (size_t t=begin; t<end; t++) {
+      const Tidx* face_idx = mesh.face_indices.data() + mesh.face_offsets[i];
+      f(std::array<Tidx,3>{ face_idx[0], face_idx[k+1], face_idx[k+2] });
+      if (++k == mesh.face_size(i)-2) {
+        k = 0;
+        i++;
+      }
+    }
+  }
+
+  // Fans polygons into a triangle mesh
+  template<typename Tfloat, typename Tidx>
+  Mesh<3, Tfloat, Tidx> triangulate(PolyMesh<Tfloat, Tidx> poly) {
+    Mesh<3, Tfloat, Tidx> mesh;
+    mesh.faces.reserve(triangle_count(poly));
+    for_each_triangle(poly, 0, triangle_count(poly), [&mesh](const std::array<Tidx,3> &t) { mesh.faces.push_back(t); });
+    mesh.vertices = std::move(poly.vertices);
+    mesh.comment = std::move(poly.comment);
+    mesh.steno_msg = std::move(poly.steno_msg);
+    mesh.steno_flags = poly.steno_flags;
+    return mesh;
+  }
+
   template<typename TMesh>
   std::array<typename TMesh::vertices_t::value_type, 2> bounding_box(const TMesh &mesh) {
     std::array<typename TMesh::vertices_t::value_type, 2> bbox =
@@ -64,6 +491,211 @@ namespace stenomesh {
       }
     return bbox;
   }
+
+  // Row major 3x4 affine matrix, v' = M[:,0:3]*v + M[:,3]
+  typedef std::array<float,12> affine_t;
+  const affine_t identity_affine = {1,0,0,0, 0,1,0,0, 0,0,1,0};
+
+  inline float affine_determinant(const affine_t &m) {
+    return m[0]*(m[5]*m[10]-m[6]*m[9]) - m[1]*(m[4]*m[10]-m[6]*m[8]) + m[2]*(m[4]*m[9]-m[5]*m[8]);
+  }
+
+  // Reverses the winding of all faces, triangles swap their first two vertices as the writer used to
+  template<size_t N, typename Tfloat, typename Tidx>
+  void flip_winding(Mesh<N, Tfloat, Tidx> &mesh) {
+    for (auto &face : mesh.faces) {
+      if (N==3)
+        std::swap(face[0], face[1]);
+      else
+        std::reverse(face.begin()+1, face.end());
+    }
+  }
+
+  // Polygons keep their first vertex, the apex of their triangle fan
+  template<typename Tfloat, typename Tidx>
+  void flip_winding(PolyMesh<Tfloat, Tidx> &mesh) {
+    for (size_t i=0; i<mesh.face_count(); i++)
+      std::reverse(mesh.face_indices.begin()+mesh.face_offsets[i]+1, mesh.face_indices.begin()+mesh.face_offsets[i+1]);
+  }
+
+  template<size_t N, typename Tfloat, typename Tidx>
+  void clear_normals(Mesh<N, Tfloat, Tidx> &mesh) {
+    mesh.normals.clear();
+  }
+
+  template<typename Tfloat, typename Tidx>
+  void clear_normals(PolyMesh<Tfloat, Tidx> &) {}
+
+  // Applies m once per vertex and returns the transformed bounding box.
+  // Mirroring transforms flip the face winding so normals keep pointing outwards.
+  template<typename TMesh>
+  std::array<typename TMesh::vertices_t::value_type, 2> transform(TMesh &mesh, const affine_t &m, size_t threads = 1) {
+    typedef typename TMesh::vertices_t::value_type vertex_t;
+    typedef std::array<vertex_t, 2> bbox_t;
+    const size_t n = mesh.vertices.size();
+    if (affine_determinant(m) < 0)
+      flip_winding(mesh);
+    clear_normals(mesh);
+    if (n==0)
+      return bbox_t();
+
+    const size_t parts = std::min(thread_count(threads), std::max<size_t>(1, n/(1<<16)));
+    const size_t range = (n+parts-1)/parts;
+    std::vector<bbox_t> boxes(parts);
+    parallel_for(parts, parts, [&](size_t pbegin, size_t pend) {
+                                 for (size_t p=pbegin; p<pend; p++) {
+                                   size_t begin = p*range;
+                                   size_t end = std::min(n, begin+range);
+                                   if (begin>=end) continue;
+                                   // Plain multiply-add loop, left to the compiler to vectorize
+                                   vertex_t *v = mesh.vertices.data();
+                                   for (size_t i=begin; i<end; i++) {
+                                     const float x = v[i][0], y = v[i][1], z = v[i][2];
+                                     v[i][0] = m[0]*x + m[1]*y + m[2]*z + m[3];
+                                     v[i][1] = m[4]*x + m[5]*y + m[6]*z + m[7];
+                                     v[i][2] = m[8]*x + m[9]*y + m[10]*z + m[11];
+                                   }
+                                   bbox_t box = { v[begin], v[begin] };
+                                   for (size_t i=begin; i<end; i++)
+                                     for (size_t k=0; k<3; k++) {
+                                       box[0][k] = std::min(box[0][k], v[i][k]);
+                                       box[1][k] = std::max(box[1][k], v[i][k]);
+                                     }
+                                   boxes[p] = box;
+                                 }
+                               }, 1);
+
+    bbox_t bbox = boxes.front();
+    for (const auto &box : boxes)
+      for (size_t k=0; k<3; k++) {
+        bbox[0][k] = std::min(bbox[0][k], box[0][k]);
+        bbox[1][k] = std::max(bbox[1][k], box[1][k]);
+      }
+    return bbox;
+  }
+
+  // Sorts vertices along a Morton curve through the bounding box and faces on their
+  // lowest vertex index, so consecutive faces gather from nearby vertices.
+  // Face winding is kept. Payloads are stored in face order, so after reordering
+  // they are carried by the faces closest to the bbox origin corner on the curve.
+  template<typename TMesh>
+  void reorder(TMesh &mesh, size_t threads = 1) {
+    typedef typename TMesh::idx_t idx_t;
+    const size_t n = mesh.vertices.size();
+    if (n==0) return;
+
+    auto bbox = bounding_box(mesh);
+    std::array<double,3> factor;
+    for (size_t i=0; i<3; i++) {
+      double extent = double(bbox[1][i]) - double(bbox[0][i]);
+      factor[i] = extent>0? ((1<<21)-1)/extent : 0;
+    }
+
+    std::vector<keyed<idx_t>> items(n);
+    parallel_for(n, threads, [&](size_t begin, size_t end) {
+                               for (size_t i=begin; i<end; i++) {
+                                 std::array<uint64_t,3> q;
+                                 for (size_t k=0; k<3; k++)
+                                   q[k] = uint64_t((mesh.vertices[i][k]-bbox[0][k])*factor[k]);
+                                 items[i] = { morton_code(q[0], q[1], q[2]), idx_t(i) };
+                               }
+                             });
+    radix_sort(items, threads);
+
+    std::vector<idx_t> remap(n);
+    typename TMesh::vertices_t vertices(n);
+    parallel_for(n, threads, [&](size_t begin, size_t end) {
+                               for (size_t i=begin; i<end; i++) {
+                                 remap[items[i].val] = i;
+                                 vertices[i] = mesh.vertices[items[i].val];
+                               }
+                             });
+    mesh.vertices.swap(vertices);
+
+    items = std::vector<keyed<idx_t>>();
+
+    // Faces are keyed by position, their count is not bound by the index type
+    const size_t n_faces = mesh.faces.size();
+    std::vector<keyed<size_t>> face_items(n_faces);
+    parallel_for(n_faces, threads, [&](size_t begin, size_t end) {
+                                     for (size_t i=begin; i<end; i++) {
+                                       auto &face = mesh.faces[i];
+                                       for (auto &idx : face) idx = remap[idx];
+                                       face_items[i] = { *std::min_element(face.begin(), face.end()), i };
+                                     }
+                                   });
+    radix_sort(face_items, threads);
+
+    typename TMesh::faces_t faces(n_faces);
+    parallel_for(n_faces, threads, [&](size_t begin, size_t end) {
+                                     for (size_t i=begin; i<end; i++)
+                                       faces[i] = mesh.faces[face_items[i].val];
+                                   });
+    mesh.faces.swap(faces);
+  }
+
+  struct cleanup_stats
+  {
+    size_t degenerate = 0;
+    size_t duplicate = 0;
+  };
+
+  // Removes faces referencing a vertex more than once and faces using the same
+  // vertices as an earlier face, in any order or winding. Faces are compared by
+  // index, so unindexed meshes need welding first.
+  // Duplicates are found by radix sorting a hash of the sorted indices, colliding
+  // faces end up in the same run and are compared exactly.
+  template<typename TMesh>
+  cleanup_stats remove_bad_faces(TMesh &mesh, size_t threads = 1) {
+    typedef typename TMesh::faces_t::value_type face_t;
+    const size_t n = mesh.faces.size();
+    cleanup_stats stats;
+
+    auto canonical = [](face_t face) {
+                       std::sort(face.begin(), face.end());
+                       return face;
+                     };
+
+    std::vector<keyed<size_t>> items(n);
+    std::vector<char> keep(n);
+    parallel_for(n, threads, [&](size_t begin, size_t end) {
+                               for (size_t i=begin; i<end; i++) {
+                                 const face_t &face = mesh.faces[i];
+                                 keep[i] = all_distinct(face);
+                                 uint64_t h = 0x9e3779b97f4a7c15ull;
+                                 for (auto idx : canonical(face)) {
+                                   h ^= uint64_t(idx);
+                                   h *= 0xff51afd7ed558ccdull;
+                                   h ^= h >> 32;
+                                 }
+                                 items[i] = { h, i };
+                               }
+                             });
+    for (auto k : keep) stats.degenerate += !k;
+
+    // Runs keep face order, so the first face of a set of duplicates is kept
+    radix_sort(items, threads);
+    for (size_t begin=0, end; begin<n; begin=end) {
+      for (end=begin+1; end<n && items[end].key==items[begin].key; end++);
+      for (size_t i=begin; i<end; i++) {
+        size_t fi = items[i].val;
+        if (!keep[fi]) continue;
+        face_t ci = canonical(mesh.faces[fi]);
+        for (size_t j=begin; j<i; j++) {
+          size_t fj = items[j].val;
+          if (keep[fj] && canonical(mesh.faces[fj])==ci) {
+            keep[fi] = false;
+            stats.duplicate++;
+            break;
+          }
+        }
+      }
+    }
+
+    if (stats.degenerate || stats.duplicate)
+      mesh.faces = parallel_filter(mesh.faces, threads, [&keep](size_t i) { return keep[i]!=0; });
+    return stats;
+  }
 }
 
 #endif // MESHPROC_HPP
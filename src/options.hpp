@@ -0,0 +1,63 @@
+// Copyright (C) 2019 hrobeers (https://github.com/hrobeers)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef OPTIONS_HPP
+#define OPTIONS_HPP
+
+#include <array>
+#include <string>
+#include <cmath>
+#include <cstddef>
+
+namespace stenomesh {
+  enum class weld_strategy { map, sort, grid };
+  enum class output_format { stl, ply };
+
+  // Mesh processing and writing options, shared by the commandline and the library
+  struct options
+  {
+    std::string header;                        // replaces the input header when not empty
+    bool ignore_length = false;                // truncate messages that do not fit
+    std::array<float, 3> scale = {1,1,1};      // applied after transform
+    std::array<float, 12> transform = {1,0,0,0, 0,1,0,0, 0,0,1,0}; // row major 3x4 affine matrix
+    std::array<float, 3> valid = {0,0,0};      // minimum bounding box size, 0 to skip
+    bool valid_watertight = false;             // no boundary or non-manifold edges
+    bool valid_manifold = false;               // no non-manifold edges
+    bool valid_oriented = false;               // consistent face winding
+    bool topology = false;                     // report edge topology, implied by the valid_ flags
+    float collapse_len = NAN;                  // weld distance, 0 welds exact duplicates only
+    float collapse_perc = NAN;                 // weld distance as % of the smallest bbox edge
+    weld_strategy strategy = weld_strategy::map;
+    bool reorder = false;
+    bool cleanup = false;
+    bool keep_normals = false;                 // write STL input normals back when the geometry is unchanged
+    bool compress = false;                     // lz compress embedded payloads when that makes them smaller
+    bool checksum = false;                     // append a crc32c to embedded payloads
+    std::string key;                           // 32 byte chacha20 key encrypting embedded payloads, empty for none
+    unsigned fec = 0;                          // minimum fec parity in percent of the payload, 0 for none
+    bool scatter = false;                      // place payload bytes at facets permuted by key
+    unsigned lsb_bits = 0;                     // low mantissa bits per STL coordinate carrying payload, 0 for none
+    bool lsb_normals = false;                  // normal coordinates carry lsb_bits too
+    output_format output = output_format::stl; // binary STL or binary little endian PLY
+    bool ply_face_payload = false;             // PLY payload property on faces rather than vertices
+    size_t threads = 0;                        // 0 uses all hardware threads
+    size_t max_memory = 0;                     // STL welds larger than this run out of core, except the grid
+                                               // strategy, and server frames beyond it are refused, 0 for no
+                                               // limit on welds and 1G on frames
+  };
+}
+
+#endif // OPTIONS_HPP
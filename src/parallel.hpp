@@ -0,0 +1,189 @@
+// Copyright (C) 2019 hrobeers (https://github.com/hrobeers)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <vector>
+#include <algorithm>
+
+#include "trace.hpp"
+
+namespace stenomesh {
+  // 0 requests one worker per hardware thread
+  inline size_t thread_count(size_t requested = 0) {
+    if (requested)
+      return requested;
+    size_t hw = std::thread::hardware_concurrency();
+    return hw? hw : 1;
+  }
+
+  // Calls f(begin, end) on contiguous ranges covering [0,n), one range per thread.
+  // The calling thread processes the last range itself.
+  template<typename F>
+  void parallel_for(size_t n, size_t threads, F f, size_t min_range = 1<<12) {
+    threads = std::min(thread_count(threads), std::max<size_t>(1, n/min_range));
+    if (threads<=1) {
+      f(size_t(0), n);
+      return;
+    }
+
+    std::vector<std::thread> workers;
+    std::vector<std::exception_ptr> errors(threads);
+    workers.reserve(threads-1);
+    size_t range = (n+threads-1)/threads;
+    for (size_t t=0; t<threads; t++) {
+      size_t begin = std::min(n, t*range);
+      size_t end = std::min(n, begin+range);
+      auto job = [&f, &errors, t, begin, end]() {
+                   trace_span span("parallel range");
+                   try { f(begin, end); }
+                   catch (...) { errors[t] = std::current_exception(); }
+                 };
+      if (t+1<threads)
+        workers.emplace_back(job);
+      else
+        job();
+    }
+    for (auto &w : workers) w.join();
+    for (auto &e : errors)
+      if (e) std::rethrow_exception(e);
+  }
+
+  // Copies the elements of in for which keep(index) holds, in order.
+  // Kept elements are counted and copied per part in parallel.
+  template<typename T, typename Fkeep>
+  std::vector<T> parallel_filter(const std::vector<T> &in, size_t threads, Fkeep keep) {
+    const size_t n = in.size();
+    const size_t parts = std::min(thread_count(threads), std::max<size_t>(1, n/(1<<16)));
+    const size_t range = (n+parts-1)/parts;
+
+    std::vector<size_t> offsets(parts+1, 0);
+    parallel_for(parts, parts, [&](size_t pbegin, size_t pend) {
+                                 for (size_t p=pbegin; p<pend; p++)
+                                   for (size_t i=p*range; i<std::min(n, (p+1)*range); i++)
+                                     offsets[p+1] += keep(i)? 1 : 0;
+                               }, 1);
+    for (size_t p=0; p<parts; p++)
+      offsets[p+1] += offsets[p];
+
+    std::vector<T> out(offsets[parts]);
+    parallel_for(parts, parts, [&](size_t pbegin, size_t pend) {
+                                 for (size_t p=pbegin; p<pend; p++) {
+                                   size_t o = offsets[p];
+                                   for (size_t i=p*range; i<std::min(n, (p+1)*range); i++)
+                                     if (keep(i)) out[o++] = in[i];
+                                 }
+                               }, 1);
+    return out;
+  }
+
+  // Calls produce(chunk, buffer) for chunks [0,n_chunks) on a pool of worker threads
+  // and consume(chunk, buffer) on the calling thread, strictly in chunk order.
+  // At most 2 buffers per worker are in flight, so memory stays bounded for any n_chunks.
+  template<typename Tbuffer, typename Fproduce, typename Fconsume>
+  void ordered_chunks(size_t n_chunks, size_t threads, Fproduce produce, Fconsume consume) {
+    threads = std::min(thread_count(threads), n_chunks);
+    if (threads<=1) {
+      Tbuffer buffer;
+      for (size_t c=0; c<n_chunks; c++) {
+        {
+          trace_span span("produce chunk");
+          produce(c, buffer);
+        }
+        trace_span span("consume chunk");
+        consume(c, buffer);
+      }
+      return;
+    }
+
+    const size_t slots = 2*threads;
+    std::vector<Tbuffer> buffers(slots);
+    std::vector<size_t> ready(slots, n_chunks); // chunk held by each slot, n_chunks if none
+    std::mutex mtx;
+    std::condition_variable cv;
+    size_t next = 0;     // next chunk to produce
+    size_t consumed = 0; // chunks handed to consume
+    bool stop = false;
+    std::exception_ptr error;
+
+    auto worker = [&]() {
+                    while (true) {
+                      size_t c;
+                      {
+                        trace_span span("wait for slot");
+                        std::unique_lock<std::mutex> lock(mtx);
+                        if (stop || next>=n_chunks) return;
+                        c = next++;
+                        cv.wait(lock, [&]() { return stop || c<consumed+slots; });
+                        if (stop) return;
+                      }
+                      try {
+                        trace_span span("produce chunk");
+                        produce(c, buffers[c%slots]);
+                      }
+                      catch (...) {
+                        std::lock_guard<std::mutex> lock(mtx);
+                        if (!error) error = std::current_exception();
+                        stop = true;
+                        cv.notify_all();
+                        return;
+                      }
+                      std::lock_guard<std::mutex> lock(mtx);
+                      ready[c%slots] = c;
+                      cv.notify_all();
+                    }
+                  };
+
+    std::vector<std::thread> workers;
+    workers.reserve(threads);
+    for (size_t t=0; t<threads; t++)
+      workers.emplace_back(worker);
+
+    try {
+      for (size_t c=0; c<n_chunks; c++) {
+        {
+          trace_span span("wait for chunk");
+          std::unique_lock<std::mutex> lock(mtx);
+          cv.wait(lock, [&]() { return stop || ready[c%slots]==c; });
+          if (stop) break;
+        }
+        {
+          trace_span span("consume chunk");
+          consume(c, buffers[c%slots]);
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+        ready[c%slots] = n_chunks;
+        consumed = c+1;
+        cv.notify_all();
+      }
+    }
+    catch (...) {
+      std::lock_guard<std::mutex> lock(mtx);
+      if (!error) error = std::current_exception();
+      stop = true;
+      cv.notify_all();
+    }
+
+    for (auto &w : workers) w.join();
+    if (error) std::rethrow_exception(error);
+  }
+}
+
+#endif // PARALLEL_HPP
@@ -0,0 +1,248 @@
+// Copyright (C) 2019 hrobeers (https://github.com/hrobeers)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef PAYLOAD_HPP
+#define PAYLOAD_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "options.hpp"
+#include "lz.hpp"
+#include "crc32c.hpp"
+#include "chacha20.hpp"
+#include "fec.hpp"
+#include "placement.hpp"
+#include "lsb.hpp"
+
+namespace stenomesh {
+  // The u32 payload length prefix holds the stored length in the low 28 bits
+  // and encoding flags in the high bits. Payloads without flags are stored as is.
+  // Messages are compressed, encrypted, checksummed and then protected by forward error correction.
+  const uint32_t payload_length_mask = (uint32_t(1)<<28)-1;
+  const uint32_t payload_compressed = uint32_t(1)<<31; // u32 message size followed by an lz block
+  const uint32_t payload_checksum = uint32_t(1)<<30;   // u32 crc32c of the preceding stored bytes appended
+  const uint32_t payload_encrypted = uint32_t(1)<<29;  // 12 byte nonce followed by the chacha20 ciphertext
+  const uint32_t payload_fec = uint32_t(1)<<28;        // the whole attribute byte stream holds fec packets, see fec.hpp
+  const uint32_t payload_known_flags = payload_compressed | payload_checksum | payload_encrypted | payload_fec;
+  const size_t payload_key_size = 32;
+  const size_t payload_nonce_size = 12;
+
+  // Whether stored ends with a valid crc32c trailer
+  inline bool payload_checksum_valid(const char *stored, size_t size) {
+    uint32_t crc;
+    if (size<sizeof(crc))
+      return false;
+    std::memcpy(&crc, stored+size-sizeof(crc), sizeof(crc));
+    return crc==crc32c(stored, size-sizeof(crc));
+  }
+
+  // Flag names as reported by --probe
+  inline std::vector<std::string> payload_flag_names(uint32_t flags) {
+    std::vector<std::string> names;
+    if (flags & payload_compressed) names.push_back("lz");
+    if (flags & payload_encrypted) names.push_back("chacha20");
+    if (flags & payload_checksum) names.push_back("crc32c");
+    if (flags & payload_fec) names.push_back("rs");
+    return names;
+  }
+
+  // Stored bytes held by the whole byte stream of a channel, flags receives the encoding.
+  // Fec packets are looked for whatever the length prefix says: losing the first facets
+  // leaves any bytes in its place, that may well pass for a plain message.
+  inline std::string stored_payload(std::string channel, uint32_t &flags) {
+    uint32_t prefix;
+    if (channel.size()<sizeof(prefix)) {
+      flags = 0;
+      return std::string();
+    }
+    std::memcpy(&prefix, channel.data(), sizeof(prefix)); // TODO big endian support
+    if ((prefix & payload_fec) || fec_packets(channel)) {
+      flags = payload_fec;
+      return channel;
+    }
+    flags = prefix & ~payload_length_mask;
+    return channel.substr(sizeof(prefix), prefix & payload_length_mask);
+  }
+
+  // Byte stream of a channel holding capacity bytes: the length prefix and the stored bytes,
+  // or the fec stream that holds its own. Longer stored bytes are clipped when ignore_length.
+  inline std::string payload_bytes(const std::string &stored, uint32_t flags, uint64_t capacity, bool ignore_length) {
+    // Fec streams hold their prefix and lose facets gracefully
+    if (flags & payload_fec)
+      return stored.substr(0, std::min<uint64_t>(stored.size(), capacity));
+    if (stored.size()>payload_length_mask ||
+        (!ignore_length && stored.size()>std::min<uint64_t>(capacity-std::min<uint64_t>(capacity, sizeof(uint32_t)), payload_length_mask)))
+      throw std::runtime_error("Steno message overflows the available storage space");
+    uint32_t prefix = uint32_t(stored.size()) | flags;
+    std::string bytes(reinterpret_cast<char*>(&prefix), sizeof(prefix));
+    bytes.append(stored, 0, std::min<uint64_t>(stored.size(), capacity));
+    return bytes;
+  }
+
+  // Stored bytes for msg, flags receives how they are encoded.
+  // capacity is the space in stored bytes fec packets are spread over, see facet_layout.
+  inline std::string encode_payload(const std::string &msg, const options &o, uint32_t &flags, size_t capacity) {
+    flags = 0;
+    std::string packed;
+    if (o.compress) {
+      uint32_t size = msg.size();
+      packed.assign(reinterpret_cast<const char*>(&size), sizeof(size)); // TODO big endian support
+      packed += lz_compress(msg);
+      // Incompressible messages are stored as is
+      if (packed.size()<msg.size())
+        flags |= payload_compressed;
+    }
+    const std::string &plain = flags & payload_compressed? packed : msg;
+
+    std::string stored;
+    if (o.key.size()) {
+      if (o.key.size()!=payload_key_size)
+        throw std::runtime_error("Payload key must be 32 bytes");
+      // The cipher writes the stored bytes, replacing the copy of the plain bytes
+      stored.resize(payload_nonce_size+plain.size());
+      std::random_device rd;
+      for (size_t i=0; i<payload_nonce_size; i++)
+        stored[i] = char(rd());
+      chacha20_xor(reinterpret_cast<const unsigned char*>(o.key.data()), reinterpret_cast<const unsigned char*>(stored.data()), 0,
+                   plain.data(), &stored[payload_nonce_size], plain.size());
+      flags |= payload_encrypted;
+    }
+    else
+      stored = plain;
+
+    if (o.checksum) {
+      uint32_t crc = crc32c(stored.data(), stored.size());
+      stored.append(reinterpret_cast<const char*>(&crc), sizeof(crc));
+      flags |= payload_checksum;
+    }
+
+    // Fec streams hold their own length prefix
+    if (o.fec) {
+      if (stored.size()>payload_length_mask)
+        throw std::runtime_error("Steno message overflows the available storage space");
+      const uint32_t info = uint32_t(stored.size()) | flags;
+      std::string packets = fec_encode(stored, info, std::min<size_t>(capacity-std::min<size_t>(capacity, sizeof(info)), payload_length_mask), o.fec);
+      if (packets.empty())
+        throw std::runtime_error("Steno message overflows the available storage space");
+      flags |= payload_fec;
+      const uint32_t prefix = uint32_t(packets.size()) | flags;
+      stored.assign(reinterpret_cast<const char*>(&prefix), sizeof(prefix));
+      stored += packets;
+    }
+    return stored;
+  }
+
+  // Message held by the stored bytes, key decrypts encrypted payloads
+  inline std::string decode_payload(std::string stored, uint32_t flags, const std::string &key = std::string()) {
+    if (flags & payload_fec) {
+      uint32_t info;
+      stored = fec_decode(stored, info, payload_length_mask);
+      flags = info & ~payload_length_mask & ~payload_fec;
+    }
+    if (flags & ~payload_length_mask & ~payload_known_flags)
+      throw std::runtime_error("Unsupported payload encoding");
+    if (flags & payload_checksum) {
+      if (!payload_checksum_valid(stored.data(), stored.size()))
+        throw std::runtime_error("Payload checksum mismatch");
+      stored.resize(stored.size()-sizeof(uint32_t));
+    }
+    if (flags & payload_encrypted) {
+      if (key.size()!=payload_key_size)
+        throw std::runtime_error("Payload is encrypted, a 32 byte key is needed");
+      if (stored.size()<payload_nonce_size)
+        throw std::runtime_error("Corrupt encrypted payload");
+      std::string plain(stored.size()-payload_nonce_size, '\0');
+      chacha20_xor(reinterpret_cast<const unsigned char*>(key.data()), reinterpret_cast<const unsigned char*>(stored.data()), 0,
+                   stored.data()+payload_nonce_size, &plain[0], plain.size());
+      stored.swap(plain);
+    }
+    if (!(flags & payload_compressed))
+      return stored;
+
+    uint32_t size;
+    if (stored.size()<sizeof(size))
+      throw std::runtime_error("Corrupt compressed payload");
+    std::memcpy(&size, stored.data(), sizeof(size));
+    if (size/255>stored.size()) // beyond the best possible ratio
+      throw std::runtime_error("Corrupt compressed payload");
+    return lz_decompress(std::string_view(stored).substr(sizeof(size)), size);
+  }
+
+  // Where the payload is stored in STL facet records. The stored bits start with a unit per facet:
+  // facet f holds unit placement.pair(f), unit_bits() bits of which the first 16 are the attribute bytes,
+  // followed by lsb_bits low mantissa bits of each normal coordinate when lsb_normals.
+  // Mantissa bits of the vertices follow: the distinct corners of the records, numbered in order of
+  // first appearance, hold vertex_bits() each, corner r holding the vertex unit placement.pair(r) of a
+  // placement over the corners. Shared corners thus stay identical and the mesh is not cracked.
+  // A unit is at most 40 bits, it is moved with a single get_bits and or_bits.
+  struct facet_layout
+  {
+    facet_placement placement;
+    unsigned lsb_bits = 0;
+    bool lsb_normals = false;
+
+    static_assert(16+3*lsb_max_bits<=57, "units fit a single bit string load");
+
+    unsigned unit_bits() const { return 16 + (lsb_normals? 3*lsb_bits : 0); }
+    unsigned vertex_bits() const { return 3*lsb_bits; }
+    // Stored bytes n_faces facets with n_vertices distinct corners hold, length prefix included
+    uint64_t capacity(uint64_t n_faces, uint64_t n_vertices) const {
+      return (n_faces*unit_bits() + n_vertices*vertex_bits())/8;
+    }
+  };
+
+  inline facet_layout payload_layout(const options &o) {
+    facet_layout l;
+    if (o.scatter) {
+      if (o.key.size()!=payload_key_size)
+        throw std::runtime_error("Scattered payloads need a 32 byte key");
+      l.placement = facet_placement(o.key);
+    }
+    if (o.lsb_bits && o.output!=output_format::stl)
+      throw std::runtime_error("Mantissa payload bits are only stored in STL output");
+    if (o.lsb_bits>lsb_max_bits)
+      throw std::runtime_error("At most " + std::to_string(lsb_max_bits) + " mantissa bits per coordinate carry payload");
+    l.lsb_bits = o.lsb_bits;
+    l.lsb_normals = o.lsb_normals;
+    return l;
+  }
+
+  // Bytes the output of mesh holds, length prefix included
+  template<typename Tmesh>
+  uint64_t payload_capacity(const Tmesh &mesh, const options &o) {
+    if (o.output==output_format::ply)
+      return ply_element_count(mesh, o.ply_face_payload);
+    const facet_layout layout = payload_layout(o);
+    return layout.capacity(triangle_count(mesh), layout.lsb_bits? stl_vertex_count(mesh) : 0);
+  }
+
+  template<typename Tmesh>
+  void set_payload(Tmesh &mesh, const std::string &msg, const options &o) {
+    mesh.steno_msg = encode_payload(msg, o, mesh.steno_flags, payload_capacity(mesh, o));
+  }
+
+  template<typename Tmesh>
+  std::string payload(const Tmesh &mesh, const options &o) {
+    return decode_payload(mesh.steno_msg, mesh.steno_flags, o.key);
+  }
+}
+
+#endif // PAYLOAD_HPP
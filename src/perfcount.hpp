@@ -0,0 +1,188 @@
+// Copyright (C) 2019 hrobeers (https://github.com/hrobeers)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef PERFCOUNT_HPP
+#define PERFCOUNT_HPP
+
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#  include <linux/perf_event.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif
+
+#include "trace.hpp"
+
+namespace stenomesh {
+  // Hardware event counts per pipeline stage from Linux perf_event_open.
+  // Counters are opened on the calling thread and inherited by the threads it spawns,
+  // the counts of joined worker threads are added to it. Only user space is counted,
+  // so no privileges are needed with the default perf_event_paranoid setting.
+  class perf_counters
+  {
+  public:
+    enum counter { cycles, instructions, cache_misses, branch_misses, n_counters };
+    typedef std::array<uint64_t, n_counters> sample_t;
+
+    struct stage
+    {
+      const char *name;
+      sample_t counts;
+    };
+
+    static perf_counters& instance() {
+      static perf_counters p;
+      return p;
+    }
+
+    // Opens the counters, returns false when none is permitted or supported
+    bool enable() {
+#ifdef __linux__
+      static const uint64_t configs[n_counters] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+      };
+      for (size_t c=0; c<n_counters; c++) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[c];
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        _fd[c] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (_fd[c]<0)
+          _error = std::strerror(errno);
+      }
+#else
+      _error = "not supported on this platform";
+#endif
+      _enabled = available(cycles) || available(instructions) || available(cache_misses) || available(branch_misses);
+      return _enabled;
+    }
+
+    bool enabled() const { return _enabled; }
+    bool available(counter c) const { return _fd[c]>=0; }
+    const std::string& error() const { return _error; }
+
+    // Current counts, scaled up when the kernel multiplexed a counter
+    sample_t read() const {
+      sample_t s{};
+#ifdef __linux__
+      for (size_t c=0; c<n_counters; c++) {
+        uint64_t v[3]; // value, time enabled, time running
+        if (_fd[c]<0 || ::read(_fd[c], v, sizeof(v))!=sizeof(v))
+          continue;
+        s[c] = v[2]? uint64_t(double(v[0])*v[1]/v[2]) : 0;
+      }
+#endif
+      return s;
+    }
+
+    void add(const char *name, const sample_t &begin, const sample_t &end) {
+      std::lock_guard<std::mutex> lock(_mtx);
+      stage s{ name, {} };
+      for (size_t c=0; c<n_counters; c++)
+        s.counts[c] = end[c]-begin[c];
+      _stages.push_back(s);
+    }
+
+    // One line per stage with IPC and misses per facet
+    void report(std::ostream &os, uint64_t facets) {
+      std::lock_guard<std::mutex> lock(_mtx);
+      if (!_enabled) {
+        os << "Performance counters unavailable: " << _error << std::endl;
+        return;
+      }
+      auto count = [this](const sample_t &s, counter c) {
+                     return available(c)? std::to_string(s[c]) : std::string("-");
+                   };
+      auto ratio = [this](const sample_t &s, counter c, counter d, uint64_t n) {
+                     std::ostringstream ss;
+                     if (available(c) && (d==n_counters || available(d)) && n)
+                       ss << std::fixed << std::setprecision(2) << double(s[c])/n;
+                     else
+                       ss << "-";
+                     return ss.str();
+                   };
+      os << std::left << std::setw(12) << "stage" << std::right
+         << std::setw(16) << "cycles" << std::setw(16) << "instructions" << std::setw(8) << "IPC"
+         << std::setw(14) << "cache-misses" << std::setw(10) << "/facet"
+         << std::setw(14) << "branch-misses" << std::setw(10) << "/facet" << std::endl;
+      for (const auto &s : _stages)
+        os << std::left << std::setw(12) << s.name << std::right
+           << std::setw(16) << count(s.counts, cycles) << std::setw(16) << count(s.counts, instructions)
+           << std::setw(8) << ratio(s.counts, instructions, cycles, s.counts[cycles])
+           << std::setw(14) << count(s.counts, cache_misses) << std::setw(10) << ratio(s.counts, cache_misses, n_counters, facets)
+           << std::setw(14) << count(s.counts, branch_misses) << std::setw(10) << ratio(s.counts, branch_misses, n_counters, facets)
+           << std::endl;
+    }
+
+  private:
+    perf_counters() = default;
+
+    std::array<int, n_counters> _fd{ -1, -1, -1, -1 };
+    bool _enabled = false;
+    std::string _error;
+    std::mutex _mtx;
+    std::vector<stage> _stages;
+  };
+
+  // Traces a pipeline stage and counts its hardware events when enabled
+  class stage_span
+  {
+  public:
+    explicit stage_span(const char *name) : _trace(name), _name(name) {
+      auto &p = perf_counters::instance();
+      if ((_counting = p.enabled()))
+        _begin = p.read();
+    }
+
+    ~stage_span() { end(); }
+
+    // Ends the stage before the end of its scope
+    void end() {
+      _trace.end();
+      if (_counting) {
+        auto &p = perf_counters::instance();
+        p.add(_name, _begin, p.read());
+      }
+      _counting = false;
+    }
+
+    stage_span(const stage_span&) = delete;
+    stage_span& operator=(const stage_span&) = delete;
+
+  private:
+    trace_span _trace;
+    const char *_name;
+    bool _counting;
+    perf_counters::sample_t _begin;
+  };
+}
+
+#endif // PERFCOUNT_HPP
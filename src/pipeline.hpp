@@ -0,0 +1,394 @@
+// Copyright (C) 2019 hrobeers (https://github.com/hrobeers)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include <istream>
+#include <sstream>
+#include <algorithm>
+#include <limits>
+#include <cstring>
+#include <stdexcept>
+
+#include "options.hpp"
+#include "stlio.hpp"
+#include "plyio.hpp"
+#include "mesh.hpp"
+#include "chash.hpp"
+#include "stringtrim.hpp"
+#include "meshproc.hpp"
+#include "extweld.hpp"
+#include "topology.hpp"
+#include "perfcount.hpp"
+
+namespace stenomesh {
+  inline std::istream& binary_read(std::istream &is, std::ostream &os, size_t cnt) {
+    for (size_t i=0; i<cnt && !is.eof(); i++)
+      os.put(is.get());
+    return is;
+  }
+
+  inline std::istream& binary_read_until(std::istream &is, std::ostream &os, std::string end_line) {
+    // TODO hash based?
+    std::string line;
+    while (std::getline(is, line)) {
+      os.write(line.c_str(), line.size());
+      os << std::endl;
+      if (line.find(end_line)!=std::string::npos)
+        break;
+    }
+    return is;
+  }
+
+  enum class input_format { ply, stl_ascii, stl_binary };
+
+  // Detects the input format, moving the bytes needed for that to header_stream
+  inline input_format read_input_header(std::istream &is, std::stringstream &header_stream) {
+    const size_t magic_byte_size = 5;
+    binary_read(is, header_stream, magic_byte_size);
+    switch(chash(header_stream.str().c_str(), ' ')) {
+    case chash("ply"):
+    case chash("PLY"):
+      binary_read_until(is, header_stream, "end_header");
+      header_stream.seekg(0);
+      return input_format::ply;
+    case chash("solid"):
+      return input_format::stl_ascii;
+    default: // Assume binary STL
+      //read until 80 bytes + facet count
+      while((size_t)header_stream.tellp()<84 && !is.eof())
+        header_stream.put(is.get());
+      return input_format::stl_binary;
+    }
+  }
+
+  // Indices are 32 bit unless the input can hold more vertices than that,
+  // the max 32 bit value is reserved.
+  inline bool needs_64bit_indices(input_format format, const std::string &header, std::istream &is) {
+    const uint64_t max_vertices = std::numeric_limits<uint32_t>::max()-1;
+    switch (format) {
+    case input_format::ply:
+      {
+        std::istringstream hs(header);
+        std::string line, token, name;
+        while (std::getline(hs, line)) {
+          std::istringstream ls(line);
+          uint64_t count = 0;
+          if (ls >> token >> name >> count && token=="element" && name=="vertex")
+            return count > max_vertices;
+        }
+        return false;
+      }
+    case input_format::stl_binary:
+      {
+        // Facet count follows the 80 byte header, unwelded facets hold 3 vertices each
+        uint32_t n_faces = 0;
+        if (header.size()>=84)
+          std::memcpy(&n_faces, header.data()+80, sizeof(n_faces));
+        return 3*uint64_t(n_faces) > max_vertices;
+      }
+    case input_format::stl_ascii:
+      {
+        // Unknown facet count, bound it by the input size if seekable.
+        // An ascii facet takes more than 64 bytes.
+        auto pos = is.tellg();
+        if (pos<0) return false;
+        is.seekg(0, std::ios::end);
+        auto end = is.tellg();
+        is.seekg(pos);
+        return end>pos && 3*uint64_t(end-pos)/64 > max_vertices;
+      }
+    }
+    return false;
+  }
+
+  // Parses through the welder matching the collapse options, returns false if the mesh still needs welding
+  // Input normals are only kept without welding.
+  template<typename Tmesh, typename Fparse>
+  bool parse_welded(Tmesh &mesh, Fparse parse, float collapse_len, weld_strategy strategy, bool keep_normals = false) {
+    if (std::isnan(collapse_len) || collapse_len<0) {
+      mesh = parse(append_inserter<Tmesh>(), keep_normals);
+      return true;
+    }
+    if (collapse_len==0)
+      mesh = parse(exact_welder<Tmesh>(), false);
+    else if (strategy==weld_strategy::grid)
+      mesh = parse(grid_welder<Tmesh>(collapse_len), false);
+    else if (strategy==weld_strategy::map)
+      mesh = parse(map_welder<Tmesh>(collapse_len), false);
+    else { // sort merge needs all vertices upfront
+      mesh = parse(append_inserter<Tmesh>(), false);
+      return false;
+    }
+    return true;
+  }
+
+  typedef std::array<std::array<float,3>,2> bbox_t;
+
+  // The transform followed by the scale
+  inline affine_t output_transform(const options &o) {
+    affine_t m = o.transform;
+    for (size_t r=0; r<3; r++)
+      for (size_t c=0; c<4; c++)
+        m[4*r+c] *= o.scale[r];
+    return m;
+  }
+
+  struct pipeline_stats
+  {
+    cleanup_stats cleanup = {0, 0};
+    bool has_topology = false;
+    topology_stats topology;
+  };
+
+  inline bool needs_topology(const options &o) {
+    return o.topology || o.valid_watertight || o.valid_manifold || o.valid_oriented;
+  }
+
+  // Spilled meshes are only produced when no topology is requested
+  inline topology_stats check_topology(const SpilledMesh &, size_t) {
+    throw std::logic_error("Topology checks need the mesh in memory");
+  }
+
+  // Applies the header and validation options, then hands the mesh to finish.
+  // bbox is the bounding box if already known.
+  template<typename Tmesh, typename Ffinish>
+  void finish_mesh(const options &o, Tmesh &mesh, Ffinish &finish, pipeline_stats &stats, const bbox_t *bbox = nullptr) {
+    if (o.header.size()>0)
+      mesh.comment = o.header;
+
+    if (std::any_of(o.valid.cbegin(), o.valid.cend(), [](float f){ return f!=0; })) {
+      stage_span span("validate");
+      const bbox_t box = bbox? *bbox : bounding_box(mesh);
+      int i=0;
+      if (std::any_of(o.valid.cbegin(), o.valid.cend(), [&i, &box](float f) {
+                                                          return box[1][i]-box[0][i++] < f;
+                                                        }))
+        throw std::runtime_error("Mesh validation failed");
+    }
+
+    if (needs_topology(o)) {
+      stage_span span("topology");
+      stats.topology = check_topology(mesh, o.threads);
+      stats.has_topology = true;
+      if ((o.valid_watertight && !stats.topology.watertight()) ||
+          (o.valid_manifold && !stats.topology.manifold()) ||
+          (o.valid_oriented && !stats.topology.oriented()))
+        throw std::runtime_error("Mesh validation failed");
+    }
+    stage_span span("finish");
+    finish(mesh);
+  }
+
+  // Parses the input with Tidx vertex indices and runs the processing stages.
+  // finish(mesh) receives the processed triangle or polygon mesh.
+  template<typename Tidx, typename Ffinish>
+  void process(const options &o, input_format format, std::istream &is, std::istream &header_stream, Ffinish finish, pipeline_stats &stats) {
+    // An STL soup has only boundary edges, its exact duplicates are welded
+    // for topology checks when no weld is given
+    const bool stl = format!=input_format::ply;
+    const float collapse_len = stl && needs_topology(o) && std::isnan(o.collapse_len) &&
+      !(!std::isnan(o.collapse_perc) && o.collapse_perc>0)? 0 : o.collapse_len;
+
+    // Polygon PLY input is only triangulated for stages that need triangles
+    const bool triangle_stages = (!std::isnan(collapse_len) && collapse_len>=0) ||
+      (!std::isnan(o.collapse_perc) && o.collapse_perc>0) || o.cleanup || o.reorder;
+
+    typedef Mesh<3, float, Tidx> mesh_t;
+    mesh_t mesh;
+    PolyMesh<float, Tidx> poly;
+    bool polygons = false;
+    std::string comment;
+    bool welded = false; // STL input is welded while parsing
+
+    stage_span parse_span("parse");
+    switch (format) {
+    case input_format::ply:
+      if (triangle_stages)
+        mesh = parsePLY<mesh_t>(is, header_stream, payload_layout(o).placement);
+      else {
+        poly = parsePLY<PolyMesh<float, Tidx>>(is, header_stream, payload_layout(o).placement);
+        polygons = true;
+      }
+      break;
+    case input_format::stl_ascii:
+      std::getline(is, comment);
+      welded = parse_welded(mesh, [&is](auto insert, bool normals) { return parseSTL_ascii<mesh_t>(is, insert, normals); },
+                            collapse_len, o.strategy, o.keep_normals && !triangle_stages);
+      ltrim(comment);
+      mesh.comment = comment;
+      break;
+    case input_format::stl_binary:
+      welded = parse_welded(mesh, [&is, &header_stream, layout = payload_layout(o)](auto insert, bool normals) {
+                                    return parseSTL<mesh_t>(is, header_stream, insert, normals, layout);
+                                  },
+                            collapse_len, o.strategy, o.keep_normals && !triangle_stages);
+      break;
+    }
+    parse_span.end();
+
+    // Optionally merge close vertices, dist==0 welds exact duplicates only
+    if (!welded && !std::isnan(collapse_len) && collapse_len>=0) {
+      stage_span span("weld");
+      vertex_merge(mesh, collapse_len, o.strategy, o.threads);
+    }
+    if (!std::isnan(o.collapse_perc) && o.collapse_perc>0) {
+      stage_span span("weld");
+      auto bbox = bounding_box(mesh);
+      float min_edge_len = bbox[1].front()-bbox[0].front();
+      for (int i=1; i<3; i++) min_edge_len = std::min(min_edge_len, bbox[1][i]-bbox[0][i]);
+      // collapse_perc as % of min bbox dim
+      vertex_merge(mesh, o.collapse_perc/100 * min_edge_len, o.strategy, o.threads);
+    }
+
+    // Optionally remove degenerate and duplicate faces
+    if (o.cleanup) {
+      stage_span span("cleanup");
+      stats.cleanup = remove_bad_faces(mesh, o.threads);
+    }
+
+    // Optionally reorder vertices and faces for memory locality
+    if (o.reorder) {
+      stage_span span("reorder");
+      reorder(mesh, o.threads);
+    }
+
+    // Transform and scale once per vertex, keeping the resulting bounding box
+    const affine_t m = output_transform(o);
+    bbox_t bbox;
+    const bool transformed = m!=identity_affine;
+    if (transformed) {
+      stage_span span("transform");
+      bbox = polygons? transform(poly, m, o.threads) : transform(mesh, m, o.threads);
+    }
+
+    if (polygons)
+      finish_mesh(o, poly, finish, stats, transformed? &bbox : nullptr);
+    else
+      finish_mesh(o, mesh, finish, stats, transformed? &bbox : nullptr);
+  }
+
+  // Whether the in-core weld of STL input would exceed max_memory.
+  // Only a plain weld runs out of core, the other stages need the whole mesh.
+  // The radius weld of the grid strategy has no out of core counterpart.
+  inline bool needs_external_weld(const options &o, input_format format, const std::string &header, std::istream &is) {
+    if (o.max_memory==0 || format==input_format::ply || o.strategy==weld_strategy::grid ||
+        std::isnan(o.collapse_len) || o.collapse_len<0 ||
+        (!std::isnan(o.collapse_perc) && o.collapse_perc>0) || o.cleanup || o.reorder || needs_topology(o))
+      return false;
+
+    // Rough peak bytes per facet while welding in core
+    const uint64_t facet_bytes = o.strategy==weld_strategy::sort? 256 : 64;
+    uint64_t n_faces = 0;
+    if (format==input_format::stl_binary) {
+      uint32_t n = 0;
+      if (header.size()>=84)
+        std::memcpy(&n, header.data()+80, sizeof(n));
+      n_faces = n;
+    }
+    else {
+      // Unknown facet count, estimate it from the input size if seekable
+      auto pos = is.tellg();
+      if (pos<0) return false;
+      is.seekg(0, std::ios::end);
+      auto end = is.tellg();
+      is.seekg(pos);
+      n_faces = end>pos? uint64_t(end-pos)/128 : 0;
+    }
+    return n_faces*facet_bytes > o.max_memory;
+  }
+
+  // Welds STL input in temporary files within max_memory
+  template<typename Ffinish>
+  void process_external(const options &o, input_format format, std::istream &is, std::istream &header_stream, Ffinish finish, pipeline_stats &stats) {
+    external_welder welder(o.collapse_len, o.max_memory, o.threads);
+    std::string comment;
+    stl_payload payload;
+    stage_span parse_span("parse");
+    if (format==input_format::stl_ascii) {
+      std::getline(is, comment);
+      ltrim(comment);
+      read_stl_ascii_facets(is, [&welder](const auto &v, const auto &) { welder(v); });
+    }
+    else
+      payload = read_stl_facets(is, header_stream, [](uint32_t) {}, [&welder](const auto &v, const auto &) { welder(v); }, payload_layout(o));
+
+    parse_span.end();
+
+    stage_span weld_span("weld");
+    SpilledMesh mesh = welder.finish(output_transform(o));
+    weld_span.end();
+    mesh.comment = comment;
+    mesh.steno_msg = std::move(payload.data);
+    mesh.steno_flags = payload.flags;
+    finish_mesh(o, mesh, finish, stats);
+  }
+
+  // Detects the input format and index width, then processes the input.
+  // stats is filled as the stages run, also when a later stage throws.
+  template<typename Ffinish>
+  void process(const options &o, std::istream &is, Ffinish finish, pipeline_stats &stats) {
+    std::stringstream header_stream;
+    input_format format;
+    {
+      stage_span span("sniff");
+      format = read_input_header(is, header_stream);
+    }
+    if (needs_external_weld(o, format, header_stream.str(), is))
+      process_external(o, format, is, header_stream, finish, stats);
+    else if (needs_64bit_indices(format, header_stream.str(), is))
+      process<uint64_t>(o, format, is, header_stream, finish, stats);
+    else
+      process<uint32_t>(o, format, is, header_stream, finish, stats);
+  }
+
+  template<typename Ffinish>
+  pipeline_stats process(const options &o, std::istream &is, Ffinish finish) {
+    pipeline_stats stats;
+    process(o, is, finish, stats);
+    return stats;
+  }
+
+  // Writes mesh in the output format of o
+  template<typename Tmesh>
+  std::ostream& write_output(const Tmesh &mesh, std::ostream &os, const options &o) {
+    if (o.output==output_format::ply)
+      return writePLY(mesh, os, o.ply_face_payload, o.ignore_length, o.threads, payload_layout(o).placement);
+    return writeSTL(mesh, os, o.ignore_length, o.threads, payload_layout(o));
+  }
+
+  // Stored payload of the input without processing, geometry is skipped where the format allows
+  inline std::string read_payload(const options &o, std::istream &is) {
+    std::stringstream header_stream;
+    switch (read_input_header(is, header_stream)) {
+    case input_format::ply:
+      {
+        auto poly = parsePLY_polygons<float, uint32_t>(is, header_stream, payload_layout(o).placement, false);
+        return decode_payload(poly.steno_msg, poly.steno_flags, o.key);
+      }
+    case input_format::stl_binary:
+      {
+        auto stored = read_stl_facets(is, header_stream, [](uint32_t) {}, [](const auto &, const auto &) {}, payload_layout(o));
+        return decode_payload(stored.data, stored.flags, o.key);
+      }
+    default:
+      return std::string(); // ascii STL holds no payload
+    }
+  }
+}
+
+#endif // PIPELINE_HPP
@@ -0,0 +1,120 @@
+// Copyright (C) 2019 hrobeers (https://github.com/hrobeers)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef PLACEMENT_HPP
+#define PLACEMENT_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "chacha20.hpp"
+
+namespace stenomesh {
+  // Keyed bijection between payload byte pairs and the facets holding them.
+  // Pairs and facets are cut in blocks of block_size, block b of the pairs is held by facet block b
+  // in the order of a Feistel network over the block width, the same for every block. The last
+  // partial block walks the cycle on beyond its size, taking block_size over its size permutations
+  // on average. Apart from that block the placement does not depend on the facet count: a dropped
+  // facet shifts the blocks after it by one record, a reader finds them back at another alignment.
+  // No table is built. Unkeyed placement is the identity.
+  class facet_placement {
+    static const int rounds = 4;
+    static const unsigned block_bits = 5;
+    static constexpr unsigned _bits[2] = { block_bits/2, block_bits-block_bits/2 }; // of the high and low part, they swap each round
+    std::array<uint64_t, rounds> _keys = {};
+    bool _keyed = false;
+    uint64_t _n = 0;
+
+    static uint64_t mask(unsigned bits) {
+      return (uint64_t(1)<<bits)-1;
+    }
+
+    // Round function, the high bits of a multiply
+    static uint64_t mix(uint64_t x, uint64_t key, unsigned bits) {
+      x = (x ^ key) * 0x9e3779b97f4a7c15ull;
+      return (x ^ (x >> 29)) >> (64-bits);
+    }
+
+    uint64_t encrypt(uint64_t x) const {
+      uint64_t l = x >> _bits[1], r = x & mask(_bits[1]);
+      for (int i=0; i<rounds; i++) {
+        const unsigned lb = _bits[i&1]; // width of l, r is _bits[~i&1] wide
+        const uint64_t t = l ^ mix(r, _keys[i], lb);
+        l = r;
+        r = t;
+      }
+      return (l << _bits[1]) | r;
+    }
+
+    uint64_t decrypt(uint64_t x) const {
+      uint64_t l = x >> _bits[1], r = x & mask(_bits[1]);
+      for (int i=rounds-1; i>=0; i--) {
+        const unsigned rb = _bits[i&1];
+        const uint64_t t = r ^ mix(l, _keys[i], rb);
+        r = l;
+        l = t;
+      }
+      return (l << _bits[1]) | r;
+    }
+
+    // Size of the block holding x
+    uint64_t block(uint64_t x) const {
+      return std::min<uint64_t>(block_size, _n-(x & ~mask(block_bits)));
+    }
+
+  public:
+    static const uint64_t block_size = uint64_t(1)<<block_bits;
+
+    facet_placement() = default;
+
+    // Round keys are the chacha20 keystream of key under a fixed nonce
+    explicit facet_placement(const std::string &key) : _keyed(true) {
+      const unsigned char nonce[12] = { 'f','a','c','e','t',' ','o','r','d','e','r',0 };
+      unsigned char zero[sizeof(_keys)] = {}, stream[sizeof(_keys)];
+      chacha20_xor(reinterpret_cast<const unsigned char*>(key.data()), nonce, 0, zero, stream, sizeof(stream));
+      std::memcpy(_keys.data(), stream, sizeof(stream)); // TODO big endian support
+    }
+
+    bool keyed() const { return _keyed; }
+
+    // Sets the facet count, byte pairs and facets are both numbered [0,n)
+    void resize(uint64_t n) {
+      _n = n;
+    }
+
+    // Facet holding byte pair p
+    uint64_t facet(uint64_t p) const {
+      if (!_keyed) return p;
+      const uint64_t base = p & ~mask(block_bits), size = block(p);
+      p &= mask(block_bits);
+      do p = encrypt(p); while (p>=size);
+      return base | p;
+    }
+
+    // Byte pair held by facet f
+    uint64_t pair(uint64_t f) const {
+      if (!_keyed) return f;
+      const uint64_t base = f & ~mask(block_bits), size = block(f);
+      f &= mask(block_bits);
+      do f = decrypt(f); while (f>=size);
+      return base | f;
+    }
+  };
+}
+
+#endif // PLACEMENT_HPP
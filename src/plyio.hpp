@@ -20,147 +20,369 @@
 #include "tinyply.h"
 #include <cstring>
 #include <iterator>
+#include <sstream>
+#include <algorithm>
+#include <limits>
 #include "chash.hpp"
+#include "mesh.hpp"
+#include "meshproc.hpp"
+#include "parallel.hpp"
+#include "payload.hpp"
 
 
 namespace stenomesh {
-  // TODO move to generic header?
-  template <class T, class M> M get_member_type(M T:: *);
-  #define GET_TYPE_OF(mem) decltype(get_member_type(&mem))
-
-  // http://loungecpp.wikidot.com/tips-and-tricks%3aindices
-  //#include <array>
-  //#include <type_traits>
-  template <std::size_t... Is>
-  struct indices {};
-  template <std::size_t N, std::size_t... Is>
-  struct build_indices: build_indices<N-1, N-1, Is...> {};
-  template <std::size_t... Is>
-  struct build_indices<0, Is...>: indices<Is...> {};
-
-  template<typename T, typename U, size_t i, size_t... Is>
-  constexpr auto array_cast_helper(const std::array<U, i> &a, indices<Is...>) -> std::array<T, i> {
-    return {{static_cast<T>(std::get<Is>(a))...}};
-  }
-
-  template<typename T, typename U, size_t i>
-  constexpr auto array_cast(const std::array<U, i> &a) -> std::array<T, i> {
-    // tag dispatch to helper with array indices
-    return array_cast_helper<T>(a, build_indices<i>());
-  }
-
-
-  template<size_t N, typename Tin, typename Tout>
-  std::vector<std::array<Tout,N>> parse_plydata(tinyply::PlyData* data) {
-    const size_t byte_size = data->buffer.size_bytes();
-    const size_t element_size = byte_size/data->count;
-
-    std::vector<std::array<Tout,N>> output;
-    output.reserve(data->count);
-    for (size_t i=0; i<byte_size; i+=element_size) {
-      const auto* v = reinterpret_cast<std::array<Tin,N>*>(data->buffer.get()+i);
-      output.push_back(array_cast<Tout, Tin, 3>(*v));
+  // Buffered access to a binary ply body
+  class ply_binary_reader
+  {
+    std::istream &is;
+    std::vector<char> buffer;
+    size_t pos = 0;
+    size_t end = 0;
+
+  public:
+    ply_binary_reader(std::istream &is) : is(is), buffer(1<<16) {}
+
+    // Pointer to the next n bytes, valid until the next call
+    const char* take(size_t n) {
+      if (end-pos < n) {
+        std::memmove(buffer.data(), buffer.data()+pos, end-pos);
+        end -= pos;
+        pos = 0;
+        // The buffer grows as data arrives, n comes from the file
+        while (end < n) {
+          if (end==buffer.size())
+            buffer.resize(std::min(n, 2*buffer.size()));
+          is.read(buffer.data()+end, buffer.size()-end);
+          if (is.gcount()==0) throw std::runtime_error("Unexpected end of ply data");
+          end += is.gcount();
+        }
+      }
+      const char* data = buffer.data()+pos;
+      pos += n;
+      return data;
+    }
+  };
+
+  template<typename T>
+  T ply_load(const char* data, bool swap) {
+    T value;
+    if (swap) {
+      char bytes[sizeof(T)];
+      std::reverse_copy(data, data+sizeof(T), bytes);
+      std::memcpy(&value, bytes, sizeof(T));
     }
-    return output;
+    else
+      std::memcpy(&value, data, sizeof(T));
+    return value;
   }
 
-  template<typename Tmesh>
-  Tmesh parsePLY(std::istream &is, std::istream &header_stream) {
-    Tmesh mesh;
+  template<typename Tout>
+  Tout ply_binary_value(tinyply::Type t, const char* data, bool swap) {
+    switch (t) {
+    case tinyply::Type::INT8: return static_cast<Tout>(ply_load<int8_t>(data, swap));
+    case tinyply::Type::UINT8: return static_cast<Tout>(ply_load<uint8_t>(data, swap));
+    case tinyply::Type::INT16: return static_cast<Tout>(ply_load<int16_t>(data, swap));
+    case tinyply::Type::UINT16: return static_cast<Tout>(ply_load<uint16_t>(data, swap));
+    case tinyply::Type::INT32: return static_cast<Tout>(ply_load<int32_t>(data, swap));
+    case tinyply::Type::UINT32: return static_cast<Tout>(ply_load<uint32_t>(data, swap));
+    case tinyply::Type::FLOAT32: return static_cast<Tout>(ply_load<float>(data, swap));
+    case tinyply::Type::FLOAT64: return static_cast<Tout>(ply_load<double>(data, swap));
+    default: throw std::runtime_error("Unsupported ply property type");
+    }
+  }
+
+  template<typename Tout>
+  Tout ply_ascii_value(tinyply::Type t, std::istream &is) {
+    if (t==tinyply::Type::FLOAT32 || t==tinyply::Type::FLOAT64) {
+      double value;
+      is >> value;
+      return static_cast<Tout>(value);
+    }
+    int64_t value;
+    is >> value;
+    return static_cast<Tout>(value);
+  }
+
+  // List counts of signed types may be negative, they would read as huge sizes
+  inline size_t ply_list_count(int64_t count) {
+    if (count<0)
+      throw std::runtime_error("Negative ply list count");
+    return size_t(count);
+  }
+
+  // Payload bytes are a uchar property of this name on vertices or faces
+  const char* const ply_payload_property = "steno";
+
+  // Whether p of e can hold the payload, the first one that can does
+  inline bool ply_payload_holder(const tinyply::PlyElement &e, const tinyply::PlyProperty &p) {
+    return (e.name=="vertex" || e.name=="face") && p.name==ply_payload_property &&
+      !p.isList && p.propertyType==tinyply::Type::UINT8;
+  }
+
+  struct ply_header
+  {
+    std::vector<tinyply::PlyElement> elements;
+    std::vector<std::string> comments;
+    bool ascii = false;
+    bool swap = false; // binary big endian
+  };
+
+  // tinyply parses the header, the format is read here as tinyply does not expose it
+  inline ply_header parse_ply_header(std::istream &header_stream) {
+    std::string header_text, line, format;
+    while (std::getline(header_stream, line)) {
+      header_text.append(line).push_back('\n');
+      std::istringstream ls(line);
+      std::string token;
+      ls >> token;
+      if (token=="format") ls >> format;
+      if (token=="end_header") break;
+    }
+    std::istringstream header_text_stream(header_text);
     tinyply::PlyFile ply;
+    ply.parse_header(header_text_stream);
+
+    ply_header h;
+    h.elements = ply.get_elements();
+    h.comments = ply.get_comments();
+    h.ascii = format=="ascii";
+    h.swap = format=="binary_big_endian";
+    if (!h.ascii && !h.swap && format!="binary_little_endian")
+      throw std::runtime_error("Unsupported ply format: " + format);
+    return h;
+  }
+
+  // Calls take(byte) for the payload property of the elements holding it in order, until it returns false.
+  // The elements before are skipped record by record, the body is not read beyond the last byte taken.
+  template<typename Ftake>
+  void read_ply_payload(std::istream &is, std::istream &header_stream, Ftake take) {
+    const ply_header h = parse_ply_header(header_stream);
+    ply_binary_reader reader(is);
+    for (const auto &e : h.elements) {
+      const auto holder = std::find_if(e.properties.begin(), e.properties.end(),
+                                       [&e](const auto &p) { return ply_payload_holder(e, p); });
+      for (size_t n=0; n<e.size; n++) {
+        for (auto p = e.properties.begin(); p!=e.properties.end(); ++p) {
+          const size_t stride = tinyply::PropertyTable[p->propertyType].stride;
+          if (p->isList) {
+            const size_t count = ply_list_count(h.ascii? ply_ascii_value<int64_t>(p->listType, is)
+                                                : ply_binary_value<int64_t>(p->listType, reader.take(tinyply::PropertyTable[p->listType].stride), h.swap));
+            if (!h.ascii)
+              reader.take(count*stride);
+            for (size_t c=0; h.ascii && c<count && is; c++)
+              ply_ascii_value<double>(p->propertyType, is);
+            continue;
+          }
+          const double value = h.ascii? ply_ascii_value<double>(p->propertyType, is)
+            : ply_binary_value<double>(p->propertyType, reader.take(stride), h.swap);
+          if (p==holder && !take(char(uint8_t(value))))
+            return;
+        }
+        if (h.ascii && !is)
+          throw std::runtime_error("Unexpected end of ply data");
+      }
+      if (holder!=e.properties.end())
+        return;
+    }
+  }
+
+  // Reads vertex coordinates and polygon faces of any size in a single pass over the ply body,
+  // all other elements and properties are skipped. The payload property of the first element holding it
+  // is read as the payload byte stream, element i holding byte placement.pair(i).
+  // Only the payload is read without geometry.
+  template<typename Tfloat = float, typename Tidx = uint32_t>
+  PolyMesh<Tfloat, Tidx> parsePLY_polygons(std::istream &is, std::istream &header_stream,
+                                           facet_placement placement = facet_placement(), bool geometry = true) {
+    PolyMesh<Tfloat, Tidx> mesh;
 
-    ply.parse_header(header_stream);
+    const ply_header h = parse_ply_header(header_stream);
+    const bool ascii = h.ascii, swap = h.swap;
 
     const char* const delim = "\n";
     std::ostringstream joined;
-    std::copy(ply.get_comments().begin(), ply.get_comments().end(),
+    std::copy(h.comments.begin(), h.comments.end(),
               std::ostream_iterator<std::string>(joined, delim));
     mesh.comment = joined.str();
 
-    // Tinyply treats parsed data as untyped byte buffers.
-    std::shared_ptr<tinyply::PlyData> vertices, faces;
-
-
-    for (auto e : ply.get_elements())
-      switch (chash(e.name.c_str())) {
-      case chash("vertex"):
-        // Extract vertices
-        vertices = ply.request_properties_from_element("vertex", { "x", "y", "z" });
-        break;
-      case chash("face"):
-        // Extract faces, supporting both "vertex_index" and "vertex_indices"
-        for (auto p : e.properties)
+    // What to do with each property of each element
+    enum class role { skip, x, y, z, face, payload };
+    size_t vertex_count = 0;
+    bool has_vertices = false, has_faces = false, has_payload = false;
+    std::string payload;
+    std::vector<std::vector<role>> roles;
+    const auto &elements = h.elements;
+    for (const auto &e : elements) {
+      roles.emplace_back(e.properties.size(), role::skip);
+      for (size_t k=0; k<e.properties.size(); k++) {
+        const auto &p = e.properties[k];
+        if (ply_payload_holder(e, p) && !has_payload) {
+          roles.back()[k] = role::payload;
+          has_payload = true;
+          payload.assign(e.size, '\0');
+          placement.resize(e.size);
+          continue;
+        }
+        switch (chash(e.name.c_str())) {
+        case chash("vertex"):
+          if (p.isList) break;
+          switch (chash(p.name.c_str())) {
+          case chash("x"): roles.back()[k] = role::x; break;
+          case chash("y"): roles.back()[k] = role::y; break;
+          case chash("z"): roles.back()[k] = role::z; break;
+          }
+          break;
+        case chash("face"):
+          // Extract faces, supporting both "vertex_index" and "vertex_indices"
           switch (chash(p.name.c_str())) {
           case chash("vertex_index"):
           case chash("vertex_indices"):
-            faces = ply.request_properties_from_element(e.name, { p.name }, 3);
+            if (!p.isList)
+              throw std::runtime_error("Face vertex indices are not a list");
+            if (!has_faces) roles.back()[k] = role::face;
+            has_faces = true;
+            break;
+          }
           break;
+        }
+      }
+      const size_t coords = std::count(roles.back().begin(), roles.back().end(), role::x) +
+        std::count(roles.back().begin(), roles.back().end(), role::y) + std::count(roles.back().begin(), roles.back().end(), role::z);
+      if (e.name=="vertex" && coords==3) {
+        has_vertices = true;
+        vertex_count = e.size;
+      }
+      if (!geometry)
+        std::replace_if(roles.back().begin(), roles.back().end(), [](role r) { return r!=role::payload; }, role::skip);
+    }
+
+    if (geometry && !has_vertices) throw std::runtime_error("Failed parsing vertices from input");
+    if (geometry && !has_faces) throw std::runtime_error("Failed parsing faces from input");
+
+    mesh.vertices.reserve(vertex_count);
+    ply_binary_reader reader(is);
+    std::array<Tfloat,3> vertex = {0,0,0};
+    for (size_t ei=0; ei<roles.size(); ei++) {
+      const auto &e = elements[ei];
+      const bool is_vertex = geometry && has_vertices && e.name=="vertex";
+      const bool is_face = std::count(roles[ei].begin(), roles[ei].end(), role::face)>0;
+      if (is_face) {
+        mesh.face_offsets.reserve(e.size+1);
+        mesh.face_indices.reserve(3*e.size);
+      }
+
+      std::vector<size_t> strides, list_strides;
+      for (const auto &p : e.properties) {
+        strides.push_back(tinyply::PropertyTable[p.propertyType].stride);
+        list_strides.push_back(p.isList? tinyply::PropertyTable[p.listType].stride : 0);
+      }
+
+      // Binary elements without lists have fixed size records, read in blocks
+      if (!ascii && std::none_of(e.properties.begin(), e.properties.end(), [](const auto &p) { return p.isList; })) {
+        std::vector<size_t> offsets;
+        size_t record = 0;
+        for (size_t k=0; k<e.properties.size(); k++) {
+          offsets.push_back(record);
+          record += strides[k];
+        }
+        const bool used = is_vertex || std::any_of(roles[ei].begin(), roles[ei].end(), [](role r) { return r!=role::skip; });
+        const size_t block = std::max<size_t>(1, (size_t(1)<<16)/std::max<size_t>(record, 1));
+        for (size_t n=0; n<e.size; ) {
+          const size_t m = std::min(block, e.size-n);
+          const char* data = reader.take(m*record);
+          for (size_t j=0; used && j<m; j++, data+=record) {
+            for (size_t k=0; k<e.properties.size(); k++) {
+              const role r = roles[ei][k];
+              if (r==role::payload)
+                payload[placement.pair(n+j)] = data[offsets[k]];
+              else if (r!=role::skip)
+                vertex[size_t(r)-size_t(role::x)] = ply_binary_value<Tfloat>(e.properties[k].propertyType, data+offsets[k], swap);
+            }
+            if (is_vertex)
+              mesh.vertices.push_back(vertex);
           }
-        break;
+          n += m;
+        }
+        continue;
       }
 
-    if (!vertices) throw std::runtime_error("Failed parsing vertices from input");
-    if (!faces) throw std::runtime_error("Failed parsing faces from input");
-
-    ply.read(is);
-
-    using vertices_t = GET_TYPE_OF(Tmesh::vertices);
-    using float_t = typename vertices_t::value_type::value_type;
-    switch (vertices->t) {
-    case tinyply::Type::INT8:
-      mesh.vertices = parse_plydata<3, int8_t, float_t>(vertices.get());
-      break;
-    case tinyply::Type::UINT8:
-      mesh.vertices = parse_plydata<3, uint8_t, float_t>(vertices.get());
-      break;
-    case tinyply::Type::INT16:
-      mesh.vertices = parse_plydata<3, int16_t, float_t>(vertices.get());
-      break;
-    case tinyply::Type::UINT16:
-      mesh.vertices = parse_plydata<3, uint16_t, float_t>(vertices.get());
-      break;
-    case tinyply::Type::INT32:
-      mesh.vertices = parse_plydata<3, int32_t, float_t>(vertices.get());
-      break;
-    case tinyply::Type::UINT32:
-      mesh.vertices = parse_plydata<3, uint32_t, float_t>(vertices.get());
-      break;
-    case tinyply::Type::FLOAT64:
-      mesh.vertices = parse_plydata<3, double, float_t>(vertices.get());
-      break;
-    case tinyply::Type::FLOAT32:
-      mesh.vertices = parse_plydata<3, float, float_t>(vertices.get());
-      break;
-    default:
-      throw std::runtime_error("Unsupported vertex type");
+      for (size_t n=0; n<e.size; n++) {
+        size_t face_begin = mesh.face_indices.size();
+        for (size_t k=0; k<e.properties.size(); k++) {
+          const auto &p = e.properties[k];
+          const role r = roles[ei][k];
+          if (p.isList) {
+            size_t count = ply_list_count(ascii? ply_ascii_value<int64_t>(p.listType, is)
+                                          : ply_binary_value<int64_t>(p.listType, reader.take(list_strides[k]), swap));
+            const char* items = ascii? nullptr : reader.take(count*strides[k]);
+            for (size_t c=0; c<count && (!ascii || is); c++) {
+              if (ascii) {
+                if (r==role::face) mesh.face_indices.push_back(ply_ascii_value<Tidx>(p.propertyType, is));
+                else ply_ascii_value<double>(p.propertyType, is);
+              }
+              else if (r==role::face)
+                mesh.face_indices.push_back(ply_binary_value<Tidx>(p.propertyType, items+c*strides[k], swap));
+            }
+          }
+          else {
+            Tfloat value = ascii? ply_ascii_value<Tfloat>(p.propertyType, is)
+              : ply_binary_value<Tfloat>(p.propertyType, reader.take(strides[k]), swap);
+            if (r==role::payload)
+              payload[placement.pair(n)] = char(uint8_t(value));
+            else if (r!=role::skip && r!=role::face)
+              vertex[size_t(r)-size_t(role::x)] = value;
+          }
+        }
+        if (ascii && !is)
+          throw std::runtime_error("Unexpected end of ply data");
+
+        if (is_vertex)
+          mesh.vertices.push_back(vertex);
+        if (is_face) {
+          // Faces need at least 3 vertices
+          if (mesh.face_indices.size()-face_begin < 3)
+            mesh.face_indices.resize(face_begin);
+          else
+            mesh.face_offsets.push_back(mesh.face_indices.size());
+        }
+      }
     }
 
-    using faces_t = GET_TYPE_OF(Tmesh::faces);
-    using idx_t = typename faces_t::value_type::value_type;
-    const size_t face_dim = sizeof(typename faces_t::value_type)/sizeof(idx_t);
-    switch (faces->t) {
-    case tinyply::Type::INT8:
-      mesh.faces = parse_plydata<face_dim, int8_t, idx_t>(faces.get());
-      break;
-    case tinyply::Type::UINT8:
-      mesh.faces = parse_plydata<face_dim, uint8_t, idx_t>(faces.get());
-      break;
-    case tinyply::Type::INT16:
-      mesh.faces = parse_plydata<face_dim, int16_t, idx_t>(faces.get());
-      break;
-    case tinyply::Type::UINT16:
-      mesh.faces = parse_plydata<face_dim, uint16_t, idx_t>(faces.get());
-      break;
-    case tinyply::Type::INT32:
-      mesh.faces = parse_plydata<face_dim, int32_t, idx_t>(faces.get());
-      break;
-    case tinyply::Type::UINT32:
-      mesh.faces = parse_plydata<face_dim, uint32_t, idx_t>(faces.get());
-      break;
-    default:
-      throw std::runtime_error("Unsupported face type");
+    for (auto idx : mesh.face_indices)
+      if (size_t(idx)>=mesh.vertices.size())
+        throw std::runtime_error("Face vertex index out of range");
+
+    mesh.steno_msg = stored_payload(std::move(payload), mesh.steno_flags);
+    return mesh;
+  }
+
+  template<typename Tfloat, typename Tidx>
+  void from_polygons(PolyMesh<Tfloat, Tidx> &&poly, PolyMesh<Tfloat, Tidx> &mesh) {
+    mesh = std::move(poly);
+  }
+
+  // Polygons are fanned into triangles, other fixed size meshes need all faces of that size
+  template<size_t N, typename Tfloat, typename Tidx>
+  void from_polygons(PolyMesh<Tfloat, Tidx> &&poly, Mesh<N, Tfloat, Tidx> &mesh) {
+    if constexpr (N==3) {
+      mesh = triangulate(std::move(poly));
+      return;
+    }
+    mesh.faces.resize(poly.face_count());
+    for (size_t i=0; i<poly.face_count(); i++) {
+      if (poly.face_size(i)!=N)
+        throw std::runtime_error("Unsupported face size");
+      std::copy_n(poly.face_indices.begin()+poly.face_offsets[i], N, mesh.faces[i].begin());
     }
+    mesh.vertices = std::move(poly.vertices);
+    mesh.comment = std::move(poly.comment);
+    mesh.steno_msg = std::move(poly.steno_msg);
+    mesh.steno_flags = poly.steno_flags;
+  }
 
+  template<typename Tmesh>
+  Tmesh parsePLY(std::istream &is, std::istream &header_stream, const facet_placement &placement = facet_placement()) {
+    Tmesh mesh;
+    from_polygons(parsePLY_polygons<typename Tmesh::float_t, typename Tmesh::idx_t>(is, header_stream, placement), mesh);
     return mesh;
   }
 
@@ -168,6 +390,127 @@ namespace stenomesh {
   Tmesh parsePLY(std::istream &is) {
     return parsePLY<Tmesh>(is, is);
   }
+
+  // Elements holding the payload in PLY output
+  template<size_t N, typename Tfloat, typename Tidx>
+  size_t ply_element_count(const Mesh<N, Tfloat, Tidx> &mesh, bool faces) {
+    return faces? mesh.faces.size() : mesh.vertices.size();
+  }
+
+  template<typename Tfloat, typename Tidx>
+  size_t ply_element_count(const PolyMesh<Tfloat, Tidx> &mesh, bool faces) {
+    return faces? mesh.face_count() : mesh.vertices.size();
+  }
+
+  const size_t ply_chunk_elements = 1<<14;
+
+  // Writes a binary little endian PLY. vertices(begin, end, f) calls f(vertex) and faces(begin, end, f)
+  // calls f(indices, size) for the elements [begin,end) in order, from worker threads for disjoint ranges.
+  // The payload byte stream is the uchar payload property of the vertices, or the faces when face_payload,
+  // element placement.facet(i) holding byte i.
+  template<typename Fvertices, typename Ffaces>
+  std::ostream& write_ply_elements(std::ostream &os, const std::string &comment, const std::string &steno_msg, uint32_t steno_flags,
+                                   size_t n_vertices, Fvertices vertices, size_t n_faces, Ffaces faces, bool face_payload,
+                                   bool ignore_msg_length = false, size_t threads = 1, facet_placement placement = facet_placement()) {
+    if (n_vertices > std::numeric_limits<uint32_t>::max())
+      throw std::runtime_error("Vertex count exceeds the uint ply index range");
+
+    const size_t n_payload = face_payload? n_faces : n_vertices;
+    placement.resize(n_payload);
+    const std::string payload = payload_bytes(steno_msg, steno_flags, n_payload, ignore_msg_length);
+    auto payload_at = [&](size_t i) {
+                        const size_t p = placement.pair(i);
+                        return p<payload.size()? payload[p] : '\0';
+                      };
+
+    os << "ply\nformat binary_little_endian 1.0\n";
+    std::istringstream comments(comment);
+    std::string line;
+    while (std::getline(comments, line)) {
+      line.erase(std::min(line.size(), line.find_first_of(std::string("\r\0", 2)))); // header padding
+      if (line.size())
+        os << "comment " << line << '\n';
+    }
+    os << "element vertex " << n_vertices << "\nproperty float x\nproperty float y\nproperty float z\n";
+    if (!face_payload)
+      os << "property uchar " << ply_payload_property << '\n';
+    os << "element face " << n_faces << "\nproperty list uchar uint vertex_indices\n";
+    if (face_payload)
+      os << "property uchar " << ply_payload_property << '\n';
+    os << "end_header\n";
+
+    // Records are formatted in chunks, the payload byte is copied along
+    auto write = [&os](size_t, const std::vector<char> &buffer) {
+                   os.write(buffer.data(), buffer.size());
+                 };
+    auto format_vertices = [&](size_t chunk, std::vector<char> &buffer) {
+                             size_t i = chunk*ply_chunk_elements;
+                             const size_t end = std::min(n_vertices, i+ply_chunk_elements);
+                             const size_t record = 12 + !face_payload;
+                             buffer.resize((end-i)*record);
+                             char* rec = buffer.data();
+                             vertices(i, end, [&](const auto &v) {
+                                 const std::array<float,3> f = { float(v[0]), float(v[1]), float(v[2]) };
+                                 std::memcpy(rec, f.data(), 12); // TODO big endian support
+                                 if (!face_payload)
+                                   rec[12] = payload_at(i);
+                                 rec += record;
+                                 i++;
+                               });
+                           };
+    ordered_chunks<std::vector<char>>((n_vertices+ply_chunk_elements-1)/ply_chunk_elements, threads, format_vertices, write);
+
+    auto format_faces = [&](size_t chunk, std::vector<char> &buffer) {
+                          size_t i = chunk*ply_chunk_elements;
+                          const size_t end = std::min(n_faces, i+ply_chunk_elements);
+                          buffer.clear();
+                          faces(i, end, [&](const auto *idx, size_t size) {
+                              if (size>255)
+                                throw std::runtime_error("Face size exceeds the uchar ply list count");
+                              buffer.push_back(char(size));
+                              for (size_t k=0; k<size; k++) {
+                                const uint32_t v = uint32_t(idx[k]);
+                                buffer.insert(buffer.end(), reinterpret_cast<const char*>(&v), reinterpret_cast<const char*>(&v)+sizeof(v));
+                              }
+                              if (face_payload)
+                                buffer.push_back(payload_at(i));
+                              i++;
+                            });
+                        };
+    ordered_chunks<std::vector<char>>((n_faces+ply_chunk_elements-1)/ply_chunk_elements, threads, format_faces, write);
+
+    return os;
+  }
+
+  template<size_t N, typename Tfloat, typename Tidx>
+  std::ostream& writePLY(const Mesh<N, Tfloat, Tidx> &mesh, std::ostream &os, bool face_payload,
+                         bool ignore_msg_length = false, size_t threads = 1, const facet_placement &placement = facet_placement()) {
+    auto vertices = [&mesh](size_t begin, size_t end, auto f) {
+                      for (size_t i=begin; i<end; i++)
+                        f(mesh.vertices[i]);
+                    };
+    auto faces = [&mesh](size_t begin, size_t end, auto f) {
+                   for (size_t i=begin; i<end; i++)
+                     f(mesh.faces[i].data(), N);
+                 };
+    return write_ply_elements(os, mesh.comment, mesh.steno_msg, mesh.steno_flags, mesh.vertices.size(), vertices, mesh.faces.size(), faces,
+                              face_payload, ignore_msg_length, threads, placement);
+  }
+
+  template<typename Tfloat, typename Tidx>
+  std::ostream& writePLY(const PolyMesh<Tfloat, Tidx> &mesh, std::ostream &os, bool face_payload,
+                         bool ignore_msg_length = false, size_t threads = 1, const facet_placement &placement = facet_placement()) {
+    auto vertices = [&mesh](size_t begin, size_t end, auto f) {
+                      for (size_t i=begin; i<end; i++)
+                        f(mesh.vertices[i]);
+                    };
+    auto faces = [&mesh](size_t begin, size_t end, auto f) {
+                   for (size_t i=begin; i<end; i++)
+                     f(mesh.face_indices.data()+mesh.face_offsets[i], mesh.face_size(i));
+                 };
+    return write_ply_elements(os, mesh.comment, mesh.steno_msg, mesh.steno_flags, mesh.vertices.size(), vertices, mesh.face_count(), faces,
+                              face_payload, ignore_msg_length, threads, placement);
+  }
 }
 
 #endif // PLYIO_HPP
@@ -0,0 +1,275 @@
+// Copyright (C) 2019 hrobeers (https://github.com/hrobeers)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef PROBE_HPP
+#define PROBE_HPP
+
+#include <algorithm>
+#include <istream>
+#include <sstream>
+#include <string>
+#include <cstring>
+#include <cstdio>
+
+#include "pipeline.hpp"
+
+namespace stenomesh {
+  // Mesh properties read from the header only
+  struct mesh_probe
+  {
+    input_format format;
+    std::string ply_format;       // ascii, binary_little_endian or binary_big_endian
+    uint64_t faces = 0;           // faces in the file, polygons count once
+    uint64_t vertices = 0;        // unwelded for STL
+    std::string comment;
+    uint64_t capacity = 0;        // payload bytes of the PLY payload property, else when written as binary STL,
+                                  // a lower bound for polygons
+    std::string payload_element;  // PLY element holding the payload property, empty when none does
+    bool payload = false;         // a plausible payload length prefix is present
+    uint32_t payload_length = 0;
+    uint32_t payload_flags = 0;
+    bool checksum_valid = false;  // the payload crc32c matches, only read with the checksum flag and without fec
+  };
+
+  inline uint64_t payload_capacity(uint64_t faces) {
+    return faces*2>sizeof(uint32_t)? std::min<uint64_t>(faces*2-sizeof(uint32_t), payload_length_mask) : 0;
+  }
+
+  // Takes the length prefix of the stored payload bytes when it is plausible for the capacity
+  inline void probe_prefix(mesh_probe &probe, uint32_t prefix) {
+    probe.payload_length = prefix & payload_length_mask;
+    probe.payload_flags = prefix & ~payload_length_mask;
+    probe.payload = probe.payload_length>0 && probe.payload_length<=probe.capacity;
+    if (!probe.payload)
+      probe.payload_length = probe.payload_flags = 0;
+  }
+
+  // Whether the checksum of the stored payload bytes is read
+  inline bool probe_checksum(const mesh_probe &probe) {
+    return (probe.payload_flags & payload_checksum) && !(probe.payload_flags & payload_fec);
+  }
+
+  // Units of n read to get the first units ones, whole blocks of them when scattered so they are placed as in the full file
+  inline uint64_t probe_units(const facet_placement &placement, uint64_t units, uint64_t n) {
+    const uint64_t b = facet_placement::block_size;
+    return std::min(n, placement.keyed()? (units+b-1)/b*b : units);
+  }
+
+  // Counts the facets of an ascii STL body without parsing vertices
+  inline uint64_t count_ascii_facets(std::istream &is) {
+    const std::string token = "endfacet";
+    std::vector<char> block(1<<20);
+    uint64_t count = 0;
+    size_t keep = 0; // tail of the previous block that may start a token
+    while (is) {
+      is.read(block.data()+keep, block.size()-keep);
+      size_t n = keep + is.gcount();
+      std::string_view view(block.data(), n);
+      for (size_t pos = view.find(token); pos!=std::string_view::npos; pos = view.find(token, pos+token.size()))
+        count++;
+      keep = std::min(n, token.size()-1);
+      std::memmove(block.data(), block.data()+n-keep, keep);
+    }
+    return count;
+  }
+
+  // Reads the header of a mesh, for ascii STL the body is scanned for facets.
+  // The payload placement of o is applied, scattered payloads are only found with their key.
+  inline mesh_probe probe_mesh(std::istream &is, const options &o = options()) {
+    std::stringstream header_stream;
+    mesh_probe probe;
+    facet_placement placement = payload_layout(o).placement;
+    probe.format = read_input_header(is, header_stream);
+    const std::string header = header_stream.str();
+
+    switch (probe.format) {
+    case input_format::stl_binary:
+      {
+        probe.comment = std::string(header.data(), strnlen(header.data(), std::min<size_t>(80, header.size())));
+        uint32_t n_faces = 0;
+        if (header.size()>=84)
+          std::memcpy(&n_faces, header.data()+80, sizeof(n_faces));
+        probe.faces = n_faces;
+        probe.vertices = 3*probe.faces;
+        probe.capacity = payload_capacity(probe.faces);
+
+        // The length prefix is held by the first 2 attribute byte pairs, only the records holding the payload are read
+        std::string attr;
+        auto read_pairs = [&](uint64_t pairs) {
+                            const uint64_t n = probe_units(placement, pairs, n_faces);
+                            std::vector<char> block(stl_chunk_faces*stl_record_size);
+                            while (attr.size()/2<n && is) {
+                              is.read(block.data(), std::min<uint64_t>(stl_chunk_faces, n-attr.size()/2)*stl_record_size);
+                              for (size_t i=0; i<size_t(is.gcount())/stl_record_size; i++)
+                                attr.append(block.data()+i*stl_record_size+48, 2);
+                            }
+                            const uint64_t read = attr.size()/2;
+                            if (read<std::min(pairs, n))
+                              return std::string();
+                            std::string placed = placement.keyed()? place_units(attr + std::string(8, '\0'), 0, read, 16, placement) : attr;
+                            return placed.substr(0, 2*std::min(pairs, read));
+                          };
+        const std::string prefix = n_faces>=2? read_pairs(2) : std::string();
+        if (prefix.size()==sizeof(uint32_t)) {
+          uint32_t length;
+          std::memcpy(&length, prefix.data(), sizeof(length));
+          probe_prefix(probe, length);
+
+          if (probe_checksum(probe)) {
+            std::string stored = read_pairs((sizeof(length)+uint64_t(probe.payload_length)+1)/2);
+            stored = stored.substr(std::min(stored.size(), sizeof(length)), probe.payload_length);
+            probe.checksum_valid = stored.size()==probe.payload_length && payload_checksum_valid(stored.data(), stored.size());
+          }
+        }
+      }
+      break;
+    case input_format::stl_ascii:
+      {
+        std::getline(is, probe.comment);
+        ltrim(probe.comment);
+        probe.faces = count_ascii_facets(is);
+        probe.vertices = 3*probe.faces;
+        probe.capacity = payload_capacity(probe.faces);
+      }
+      break;
+    case input_format::ply:
+      {
+        std::istringstream hs(header);
+        std::string line;
+        while (std::getline(hs, line)) {
+          std::istringstream ls(line);
+          std::string keyword, name;
+          ls >> keyword;
+          if (keyword=="format")
+            ls >> probe.ply_format;
+          else if (keyword=="comment") {
+            std::getline(ls, name);
+            ltrim(name);
+            probe.comment += name + "\n";
+          }
+          else if (keyword=="element") {
+            uint64_t count = 0;
+            ls >> name >> count;
+            if (name=="vertex") probe.vertices = count;
+            if (name=="face") probe.faces = count;
+          }
+        }
+        probe.capacity = payload_capacity(probe.faces);
+        if (probe.ply_format!="ascii" && probe.ply_format!="binary_little_endian" && probe.ply_format!="binary_big_endian")
+          break;
+
+        // The payload property holds a byte per element, only the records up to the payload are read
+        std::istringstream elements_stream(header);
+        uint64_t n_elements = 0;
+        for (const auto &e : parse_ply_header(elements_stream).elements)
+          if (probe.payload_element.empty() && std::any_of(e.properties.begin(), e.properties.end(),
+                                                           [&e](const auto &p) { return ply_payload_holder(e, p); })) {
+            probe.payload_element = e.name;
+            probe.capacity = e.size>sizeof(uint32_t)? std::min<uint64_t>(e.size-sizeof(uint32_t), payload_length_mask) : 0;
+            n_elements = e.size;
+            placement.resize(n_elements);
+          }
+        if (probe.payload_element.empty())
+          break;
+        // Element i holds byte placement.pair(i), whole blocks of elements are read
+        std::string attr, stored;
+        size_t needed = sizeof(uint32_t);
+        bool prefix_read = false;
+        std::istringstream payload_stream(header);
+        read_ply_payload(is, payload_stream, [&](char c) {
+                           attr.push_back(c);
+                           if (attr.size()<probe_units(placement, needed, n_elements))
+                             return true;
+                           stored.assign(attr.size(), '\0');
+                           for (size_t i=0; i<attr.size(); i++)
+                             stored[placement.pair(i)] = attr[i];
+                           if (prefix_read || stored.size()<sizeof(uint32_t))
+                             return false;
+                           prefix_read = true;
+                           uint32_t prefix;
+                           std::memcpy(&prefix, stored.data(), sizeof(prefix)); // TODO big endian support
+                           probe_prefix(probe, prefix);
+                           if (!probe_checksum(probe))
+                             return false;
+                           needed += probe.payload_length;
+                           return attr.size()<probe_units(placement, needed, n_elements);
+                         });
+        if (probe_checksum(probe))
+          probe.checksum_valid = stored.size()>=needed &&
+            payload_checksum_valid(stored.data()+sizeof(uint32_t), probe.payload_length);
+      }
+      break;
+    }
+    return probe;
+  }
+
+  inline std::string json_string(const std::string &str) {
+    std::string out = "\"";
+    for (unsigned char c : str) {
+      switch (c) {
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      default:
+        if (c<0x20 || c>=0x7f) {
+          // Headers are not guaranteed to be text, escape all non ascii bytes
+          char esc[8];
+          std::snprintf(esc, sizeof(esc), "\\u%04x", c);
+          out += esc;
+        }
+        else
+          out += c;
+      }
+    }
+    return out + "\"";
+  }
+
+  inline std::string to_json(const mesh_probe &probe) {
+    std::ostringstream os;
+    os << "{\"format\":";
+    switch (probe.format) {
+    case input_format::ply:
+      os << "\"ply\",\"ply_format\":" << json_string(probe.ply_format);
+      if (!probe.payload_element.empty())
+        os << ",\"payload_element\":" << json_string(probe.payload_element);
+      break;
+    case input_format::stl_ascii: os << "\"stl_ascii\""; break;
+    case input_format::stl_binary: os << "\"stl_binary\""; break;
+    }
+    os << ",\"faces\":" << probe.faces
+       << ",\"vertices\":" << probe.vertices
+       << ",\"comment\":" << json_string(probe.comment)
+       << ",\"capacity\":" << probe.capacity
+       << ",\"payload\":" << (probe.payload? "true" : "false");
+    if (probe.payload)
+      os << ",\"payload_length\":" << probe.payload_length;
+    if (probe.payload_flags) {
+      os << ",\"payload_encoding\":[";
+      auto names = payload_flag_names(probe.payload_flags);
+      for (size_t i=0; i<names.size(); i++)
+        os << (i? "," : "") << json_string(names[i]);
+      os << "]";
+    }
+    if (probe_checksum(probe))
+      os << ",\"checksum_valid\":" << (probe.checksum_valid? "true" : "false");
+    os << "}";
+    return os.str();
+  }
+}
+
+#endif // PROBE_HPP
@@ -0,0 +1,104 @@
+// Copyright (C) 2019 hrobeers (https://github.com/hrobeers)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef RADIXSORT_HPP
+#define RADIXSORT_HPP
+
+#include <array>
+#include <vector>
+#include <cstdint>
+
+#include "parallel.hpp"
+
+namespace stenomesh {
+  template<typename Tval>
+  struct keyed
+  {
+    uint64_t key;
+    Tval val;
+  };
+
+  // Stable LSD radix sort on key, 8 bits per pass.
+  // Passes where all keys share the same digit are skipped.
+  // Each pass counts and scatters on contiguous parts of items in parallel.
+  template<typename Tval>
+  void radix_sort(std::vector<keyed<Tval>> &items, size_t threads = 1) {
+    trace_span span("radix sort");
+    const size_t n = items.size();
+    const size_t parts = std::min(thread_count(threads), std::max<size_t>(1, n/(1<<16)));
+    const size_t range = (n+parts-1)/parts;
+    typedef std::array<size_t,256> histogram_t;
+
+    // Digit histograms of all passes in one sweep
+    std::vector<std::array<histogram_t,8>> counts(parts);
+    parallel_for(parts, parts, [&](size_t pbegin, size_t pend) {
+                                 for (size_t p=pbegin; p<pend; p++) {
+                                   for (auto &h : counts[p]) h.fill(0);
+                                   size_t end = std::min(n, (p+1)*range);
+                                   for (size_t i=p*range; i<end; i++)
+                                     for (size_t pass=0; pass<8; pass++)
+                                       counts[p][pass][(items[i].key >> (8*pass)) & 0xff]++;
+                                 }
+                               }, 1);
+    std::vector<size_t> passes;
+    for (size_t pass=0; pass<8; pass++) {
+      bool trivial = false;
+      for (size_t d=0; d<256 && !trivial; d++) {
+        size_t total = 0;
+        for (size_t p=0; p<parts; p++) total += counts[p][pass][d];
+        trivial = total==n;
+      }
+      if (!trivial) passes.push_back(pass);
+    }
+
+    std::vector<keyed<Tval>> tmp(passes.empty()? 0 : n);
+    for (size_t i=0; i<passes.size(); i++) {
+      const size_t shift = 8*passes[i];
+      std::vector<histogram_t> offsets(parts);
+
+      // Items moved between parts in the previous pass, recount this digit
+      if (i>0)
+        parallel_for(parts, parts, [&](size_t pbegin, size_t pend) {
+                                     for (size_t p=pbegin; p<pend; p++) {
+                                       auto &h = counts[p][passes[i]];
+                                       h.fill(0);
+                                       size_t end = std::min(n, (p+1)*range);
+                                       for (size_t j=p*range; j<end; j++)
+                                         h[(items[j].key >> shift) & 0xff]++;
+                                     }
+                                   }, 1);
+
+      // Digit major, part minor offsets keep the sort stable
+      size_t offset = 0;
+      for (size_t d=0; d<256; d++)
+        for (size_t p=0; p<parts; p++) {
+          offsets[p][d] = offset;
+          offset += counts[p][passes[i]][d];
+        }
+
+      parallel_for(parts, parts, [&](size_t pbegin, size_t pend) {
+                                   for (size_t p=pbegin; p<pend; p++) {
+                                     auto &off = offsets[p];
+                                     size_t end = std::min(n, (p+1)*range);
+                                     for (size_t j=p*range; j<end; j++)
+                                       tmp[off[(items[j].key >> shift) & 0xff]++] = items[j];
+                                   }
+                                 }, 1);
+      items.swap(tmp);
+    }
+  }
+}
+
+#endif // RADIXSORT_HPP
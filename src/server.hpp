@@ -0,0 +1,438 @@
+// Copyright (C) 2019 hrobeers (https://github.com/hrobeers)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "libstenomesh.hpp"
+#include "parallel.hpp"
+
+// Request frame, little endian:
+//   u8 op ('e' embed, 'x' extract, 'c' capacity), u8 source (0 inline, 1 path, 2 fd), 6 reserved bytes,
+//   u64 mesh size (inline mesh bytes or path length, 0 for fd), u64 payload size,
+//   followed by the inline mesh or path and the payload.
+// The fd source passes the mesh file descriptor as SCM_RIGHTS ancillary data with the request header.
+// Response frame:
+//   u8 status (0 ok, 1 error), 7 reserved bytes, u64 size,
+//   followed by the output mesh, the payload, the u64 capacity or the error message.
+namespace stenomesh {
+  enum class mesh_source : uint8_t { inline_bytes = 0, path = 1, fd = 2 };
+
+  const size_t request_header_size = 24;
+  const size_t response_header_size = 16;
+  const uint64_t request_max_frame = uint64_t(1)<<30; // frame bytes without options::max_memory
+  const uint64_t request_max_path = 4096;
+
+  class connection
+  {
+  public:
+    connection(int in_fd, int out_fd) : _in(in_fd), _out(out_fd) {
+      struct stat st;
+      _socket = fstat(in_fd, &st)==0 && S_ISSOCK(st.st_mode);
+    }
+
+    // Returns false on end of stream before the first byte
+    bool read(char *data, size_t size) {
+      size_t done = 0;
+      while (done<size) {
+        ssize_t n = _socket? receive(data+done, size-done) : ::read(_in, data+done, size-done);
+        if (n<0 && errno==EINTR) continue;
+        if (n<0) throw std::runtime_error(std::string("Read failed: ") + std::strerror(errno));
+        if (n==0) {
+          if (done==0) return false;
+          throw std::runtime_error("Truncated request");
+        }
+        done += n;
+      }
+      return true;
+    }
+
+    void write(const char *data, size_t size) {
+      while (size) {
+        ssize_t n = _socket? ::send(_out, data, size, MSG_NOSIGNAL) : ::write(_out, data, size);
+        if (n<0 && errno==EINTR) continue;
+        if (n<0) throw std::runtime_error(std::string("Write failed: ") + std::strerror(errno));
+        data += n;
+        size -= n;
+      }
+    }
+
+    // File descriptor received with the last request header, -1 if none. The caller owns it.
+    int take_fd() {
+      int fd = _passed_fd;
+      _passed_fd = -1;
+      return fd;
+    }
+
+    ~connection() {
+      if (_passed_fd>=0) close(_passed_fd);
+    }
+
+  private:
+    ssize_t receive(char *data, size_t size) {
+      iovec iov = { data, size };
+      alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+      msghdr msg = {};
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+      ssize_t n = recvmsg(_in, &msg, MSG_CMSG_CLOEXEC);
+      for (cmsghdr *c = CMSG_FIRSTHDR(&msg); n>0 && c; c = CMSG_NXTHDR(&msg, c))
+        if (c->cmsg_level==SOL_SOCKET && c->cmsg_type==SCM_RIGHTS) {
+          if (_passed_fd>=0) close(_passed_fd);
+          std::memcpy(&_passed_fd, CMSG_DATA(c), sizeof(int));
+        }
+      return n;
+    }
+
+    int _in;
+    int _out;
+    bool _socket;
+    int _passed_fd = -1;
+  };
+
+  // Read-only view on a mesh file, memory mapped when possible
+  class mapped_file
+  {
+  public:
+    // Takes ownership of fd, pipes and other unmappable files are read into buffer
+    mapped_file(int fd, std::string &buffer) {
+      struct stat st;
+      if (fstat(fd, &st)==0 && S_ISREG(st.st_mode) && st.st_size>0) {
+        void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map!=MAP_FAILED) {
+          _map = map;
+          _view = std::string_view(static_cast<const char*>(map), st.st_size);
+        }
+      }
+      if (!_map) {
+        buffer.clear();
+        char chunk[1<<16];
+        ssize_t n;
+        while ((n = ::read(fd, chunk, sizeof(chunk)))!=0) {
+          if (n<0 && errno==EINTR) continue;
+          if (n<0) {
+            close(fd);
+            throw std::runtime_error(std::string("Mesh read failed: ") + std::strerror(errno));
+          }
+          buffer.append(chunk, n);
+        }
+        _view = buffer;
+      }
+      close(fd);
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    ~mapped_file() {
+      if (_map) munmap(_map, _view.size());
+    }
+
+    std::string_view view() const { return _view; }
+
+  private:
+    void *_map = nullptr;
+    std::string_view _view;
+  };
+
+  // Buffers reused across the requests handled by one worker
+  struct request_buffers
+  {
+    std::string mesh;
+    std::string payload;
+    std::vector<char> out;
+  };
+
+  inline uint64_t load_u64(const char *data) {
+    uint64_t v;
+    std::memcpy(&v, data, sizeof(v));
+    return v;
+  }
+
+  inline void write_response(connection &conn, uint8_t status, const char *data, uint64_t size) {
+    char header[response_header_size] = {};
+    header[0] = status;
+    std::memcpy(header+8, &size, sizeof(size));
+    conn.write(header, sizeof(header));
+    conn.write(data, size);
+  }
+
+  // Handles one request, returns false at the end of the stream
+  inline bool handle_request(connection &conn, const options &o, request_buffers &buf) {
+    char header[request_header_size];
+    if (!conn.read(header, sizeof(header)))
+      return false;
+    const char op = header[0];
+    const auto source = static_cast<mesh_source>(header[1]);
+    const uint64_t mesh_size = load_u64(header+8);
+    const uint64_t payload_size = load_u64(header+16);
+    int fd = conn.take_fd();
+
+    // Frame sizes come from the client and are checked before allocating.
+    // A frame beyond them is not consumed, the connection ends after the error.
+    const uint64_t limit = o.max_memory? o.max_memory : request_max_frame;
+    const char *reject = nullptr;
+    if (source==mesh_source::path && mesh_size>request_max_path)
+      reject = "Mesh path too long";
+    else if (mesh_size>limit || payload_size>limit-mesh_size)
+      reject = "Request frame exceeds the memory limit";
+    if (reject) {
+      if (fd>=0) close(fd);
+      write_response(conn, 1, reject, std::strlen(reject));
+      return false;
+    }
+
+    // Consume the whole frame before handling errors, the stream stays in sync
+    buf.mesh.resize(mesh_size);
+    buf.payload.resize(payload_size);
+    conn.read(buf.mesh.data(), mesh_size);
+    conn.read(buf.payload.data(), payload_size);
+
+    try {
+      std::string_view mesh = buf.mesh;
+      std::unique_ptr<mapped_file> file;
+      std::string read_buffer;
+      if (source==mesh_source::path) {
+        if (fd>=0) close(fd);
+        fd = open(buf.mesh.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd<0)
+          throw std::runtime_error("Cannot open " + buf.mesh + ": " + std::strerror(errno));
+      }
+      if (source==mesh_source::path || source==mesh_source::fd) {
+        if (fd<0)
+          throw std::runtime_error("Request without file descriptor");
+        file.reset(new mapped_file(fd, read_buffer));
+        fd = -1;
+        mesh = file->view();
+      }
+      else if (source!=mesh_source::inline_bytes)
+        throw std::runtime_error("Unknown mesh source");
+      if (fd>=0) {
+        close(fd);
+        fd = -1;
+      }
+
+      switch (op) {
+      case 'e':
+        embed(mesh, buf.payload, o, buf.out);
+        write_response(conn, 0, buf.out.data(), buf.out.size());
+        break;
+      case 'x':
+        {
+          std::string payload = extract(mesh, o);
+          write_response(conn, 0, payload.data(), payload.size());
+        }
+        break;
+      case 'c':
+        {
+          uint64_t cap = capacity(mesh, o);
+          write_response(conn, 0, reinterpret_cast<char*>(&cap), sizeof(cap));
+        }
+        break;
+      default:
+        throw std::runtime_error("Unknown request");
+      }
+    }
+    catch (const std::exception &e) {
+      if (fd>=0) close(fd);
+      std::string msg = e.what();
+      write_response(conn, 1, msg.data(), msg.size());
+    }
+    return true;
+  }
+
+  // Handles requests from in_fd in order, until the end of the stream
+  inline void serve_stream(int in_fd, int out_fd, const options &o) {
+    connection conn(in_fd, out_fd);
+    request_buffers buf;
+    while (handle_request(conn, o, buf));
+  }
+
+  // Accepts connections on a unix domain socket. Idle connections are polled by the accepting thread,
+  // a connection with a request is handed to one of workers threads for that request only, so idle
+  // clients hold no worker. Requests run single threaded, concurrency comes from the connections.
+  // The workers are joined before returning, also when accepting fails.
+  inline void serve_socket(const std::string &path, options o, size_t workers) {
+    o.threads = 1;
+    workers = thread_count(workers);
+
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size()>=sizeof(addr.sun_path))
+      throw std::runtime_error("Socket path too long");
+    path.copy(addr.sun_path, sizeof(addr.sun_path)-1);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock<0)
+      throw std::runtime_error(std::string("Cannot create socket: ") + std::strerror(errno));
+    // Replace a stale socket, never another file
+    struct stat st;
+    if (lstat(path.c_str(), &st)==0 && S_ISSOCK(st.st_mode))
+      unlink(path.c_str());
+    if (bind(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))<0 || listen(sock, 128)<0) {
+      std::string err = std::strerror(errno);
+      close(sock);
+      throw std::runtime_error("Cannot listen on " + path + ": " + err);
+    }
+    // Workers wake the accepting thread when they hand a connection back
+    int wake[2];
+    if (pipe2(wake, O_CLOEXEC | O_NONBLOCK)<0) {
+      std::string err = std::strerror(errno);
+      close(sock);
+      throw std::runtime_error("Cannot create pipe: " + err);
+    }
+
+    // The accepting thread owns the client fds: idle ones are polled, busy ones are with the workers
+    std::vector<int> idle, busy;
+    std::deque<int> ready, open, closed; // to the workers, back from them
+    bool stopping = false;
+    std::mutex mtx;
+    std::condition_variable cv;
+    auto worker = [&]() {
+                    request_buffers buf; // warm for the lifetime of the worker
+                    while (true) {
+                      int client;
+                      {
+                        std::unique_lock<std::mutex> lock(mtx);
+                        cv.wait(lock, [&]() { return stopping || !ready.empty(); });
+                        if (stopping)
+                          return;
+                        client = ready.front();
+                        ready.pop_front();
+                      }
+                      bool more = false;
+                      try {
+                        connection conn(client, client);
+                        more = handle_request(conn, o, buf);
+                      }
+                      catch (const std::exception &) {
+                        // Broken connection, drop it
+                      }
+                      {
+                        std::lock_guard<std::mutex> lock(mtx);
+                        (more? open : closed).push_back(client);
+                      }
+                      const char c = 0;
+                      while (::write(wake[1], &c, 1)<0 && errno==EINTR);
+                    }
+                  };
+    std::vector<std::thread> threads;
+    auto stop = [&]() {
+                  {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    stopping = true;
+                  }
+                  cv.notify_all();
+                  // Requests in progress end on the shut down connections
+                  for (int client : busy)
+                    shutdown(client, SHUT_RDWR);
+                  for (auto &t : threads)
+                    t.join();
+                  for (auto owned : { &idle, &busy })
+                    for (int client : *owned)
+                      close(client);
+                  close(wake[0]);
+                  close(wake[1]);
+                  close(sock);
+                };
+
+    try {
+      for (size_t t=0; t<workers; t++)
+        threads.emplace_back(worker);
+
+      std::vector<pollfd> fds;
+      while (true) {
+        fds.assign({ { sock, POLLIN, 0 }, { wake[0], POLLIN, 0 } });
+        for (int client : idle)
+          fds.push_back({ client, POLLIN, 0 });
+        if (poll(fds.data(), fds.size(), -1)<0) {
+          if (errno==EINTR) continue;
+          throw std::runtime_error(std::string("Poll failed: ") + std::strerror(errno));
+        }
+
+        // Connections with a request, or closed by the client, go to the workers
+        std::vector<int> still_idle;
+        {
+          std::lock_guard<std::mutex> lock(mtx);
+          for (size_t i=0; i<idle.size(); i++)
+            if (fds[i+2].revents) {
+              ready.push_back(idle[i]);
+              busy.push_back(idle[i]);
+              cv.notify_one();
+            }
+            else
+              still_idle.push_back(idle[i]);
+        }
+        idle.swap(still_idle);
+
+        // Connections handed back after a request
+        if (fds[1].revents) {
+          char drain[64];
+          while (::read(wake[0], drain, sizeof(drain))>0);
+          std::lock_guard<std::mutex> lock(mtx);
+          for (auto *back : { &open, &closed }) {
+            for (int client : *back) {
+              busy.erase(std::find(busy.begin(), busy.end(), client));
+              if (back==&open)
+                idle.push_back(client);
+              else
+                close(client);
+            }
+            back->clear();
+          }
+        }
+
+        if (fds[0].revents) {
+          int client = accept4(sock, nullptr, nullptr, SOCK_CLOEXEC);
+          if (client<0) {
+            if (errno==EINTR || errno==ECONNABORTED) continue;
+            throw std::runtime_error(std::string("Accept failed: ") + std::strerror(errno));
+          }
+          idle.push_back(client);
+        }
+      }
+    }
+    catch (...) {
+      stop();
+      throw;
+    }
+  }
+}
+
+#endif // SERVER_HPP
@@ -18,12 +18,15 @@
 #include <fstream>
 #include <sstream>
 #include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
 
-#include "stlio.hpp"
-#include "plyio.hpp"
-#include "mesh.hpp"
-#include "stringtrim.hpp"
-#include "meshproc.hpp"
+#include <getopt.h>
+
+#include "pipeline.hpp"
+#include "server.hpp"
+#include "probe.hpp"
 
 using namespace stenomesh;
 
@@ -35,24 +38,6 @@ using namespace stenomesh;
 #  define SET_BINARY_MODE(file)
 #endif
 
-std::istream& binary_read(std::istream &is, std::ostream &os, size_t cnt) {
-  for (size_t i=0; i<cnt && !is.eof(); i++)
-    os.put(is.get());
-  return is;
-}
-
-std::istream& binary_read_until(std::istream &is, std::ostream &os, std::string end_line) {
-  // TODO hash based?
-  std::string line;
-  while (std::getline(is, line)) {
-    os.write(line.c_str(), line.size());
-    os << std::endl;
-    if (line.find(end_line)!=std::string::npos)
-      break;
-  }
-  return is;
-}
-
 std::string peek_bytes(std::istream &is, size_t cnt) {
   auto pos = is.tellg();
   std::string str(cnt, 0);
@@ -61,6 +46,38 @@ std::string peek_bytes(std::istream &is, size_t cnt) {
   return str;
 }
 
+// 32 byte key from 64 hex digits or 32 raw bytes
+std::string parse_key(std::string str) {
+  std::string hex = str;
+  hex.erase(std::remove_if(hex.begin(), hex.end(), [](char c) { return std::isspace((unsigned char)c); }), hex.end());
+  if (hex.size()==2*payload_key_size && std::all_of(hex.begin(), hex.end(), [](char c) { return std::isxdigit((unsigned char)c); })) {
+    std::string key(payload_key_size, 0);
+    for (size_t i=0; i<key.size(); i++)
+      key[i] = char(std::stoi(hex.substr(2*i, 2), nullptr, 16));
+    return key;
+  }
+  if (str.size()==payload_key_size)
+    return str;
+  throw std::runtime_error("Key must be 64 hex digits or 32 bytes");
+}
+
+// 3x4 row major affine matrix from 12 values separated by commas or whitespace
+affine_t parse_affine(std::string str) {
+  std::replace(str.begin(), str.end(), ',', ' ');
+  std::istringstream is(str);
+  affine_t m;
+  size_t n = 0;
+  float v;
+  while (is >> v) {
+    if (n==m.size())
+      throw std::runtime_error("Transform needs 12 values");
+    m[n++] = v;
+  }
+  if (n!=m.size() || !is.eof())
+    throw std::runtime_error("Transform needs 12 values");
+  return m;
+}
+
 int main(int argc, char **argv)
 {
   try {
@@ -72,16 +89,67 @@ int main(int argc, char **argv)
     int opt;
     bool extract = false;
     bool attr = false;
-    std::string header;
     std::string steno_msg;
-    bool ignore_length = false;
-    std::array<float, 3> scale = {1,1,1};
-    std::array<float, 3> valid = {0,0,0};
-    float collapse_len = NAN;
-    float collapse_perc = NAN;
+    std::string serve;
+    std::string topology_file;
+    std::string trace_file;
+    bool perf = false;
+    bool probe = false;
+    options o;
+    // Payload key, --key-file overrides it
+    if (const char *key = std::getenv("STENOMESH_KEY"))
+      o.key = parse_key(key);
 
-    while ((opt = getopt(argc, argv, "axh:m:f:is:c:p:v:")) != -1) {
+    enum { opt_serve = 256, opt_max_memory, opt_probe, opt_transform_file, opt_topology, opt_trace, opt_perf_counters, opt_checksum, opt_key_file, opt_fec, opt_scatter, opt_lsb, opt_ply };
+    static const struct option long_options[] = {
+      {"serve", required_argument, nullptr, opt_serve},
+      {"max-memory", required_argument, nullptr, opt_max_memory},
+      {"probe", no_argument, nullptr, opt_probe},
+      {"transform-file", required_argument, nullptr, opt_transform_file},
+      {"topology", required_argument, nullptr, opt_topology},
+      {"trace", required_argument, nullptr, opt_trace},
+      {"perf-counters", no_argument, nullptr, opt_perf_counters},
+      {"checksum", no_argument, nullptr, opt_checksum},
+      {"key-file", required_argument, nullptr, opt_key_file},
+      {"fec", required_argument, nullptr, opt_fec},
+      {"scatter", no_argument, nullptr, opt_scatter},
+      {"lsb", required_argument, nullptr, opt_lsb},
+      {"ply", required_argument, nullptr, opt_ply},
+      {nullptr, 0, nullptr, 0}
+    };
+
+    while ((opt = getopt_long(argc, argv, "axh:m:f:is:t:c:p:v:j:w:rdnz", long_options, nullptr)) != -1) {
       switch (opt) {
+      case opt_serve:
+        serve = optarg;
+        break;
+      case opt_topology:
+        topology_file = optarg;
+        o.topology = true;
+        break;
+      case opt_trace:
+        trace_file = optarg;
+        tracer::instance().enable();
+        break;
+      case opt_perf_counters:
+        perf = true;
+        perf_counters::instance().enable();
+        break;
+      case opt_probe:
+        probe = true;
+        break;
+      case opt_max_memory:
+        {
+          // Bytes with an optional K, M or G suffix
+          char *suffix;
+          o.max_memory = strtoull(optarg, &suffix, 10);
+          switch (*suffix) {
+          case 'G': case 'g': o.max_memory <<= 10; [[fallthrough]];
+          case 'M': case 'm': o.max_memory <<= 10; [[fallthrough]];
+          case 'K': case 'k': o.max_memory <<= 10; break;
+          }
+        }
+        break;
       case 'a':
         attr = true;
         break;
@@ -89,7 +157,7 @@ int main(int argc, char **argv)
         extract = true;
         break;
       case 'h':
-        header = optarg;
+        o.header = optarg;
         break;
       case 'm':
         steno_msg = optarg;
@@ -103,11 +171,11 @@ int main(int argc, char **argv)
           t.seekg(0, std::ios::beg);
 
           steno_msg.assign((std::istreambuf_iterator<char>(t)),
-                           std::istreambuf_iterator<char>());
+                             std::istreambuf_iterator<char>());
         }
         break;
       case 'i':
-        ignore_length = true;
+        o.ignore_length = true;
         break;
       case 's':
         {
@@ -119,50 +187,164 @@ int main(int argc, char **argv)
           size_t pos = 0;
           while((pos = sarg.find(delim)) != std::string::npos) {
             s = (float)atof(sarg.substr(0,pos).c_str());
-            scale[dim++]*=s;
+            o.scale[dim++]*=s;
             sarg.erase(0,pos+1);
           }
 
           s = (float)atof(sarg.c_str());
           while (dim<3)
-            scale[dim++]*=s;
+            o.scale[dim++]*=s;
 
           break;
         }
+      case 't':
+        o.transform = parse_affine(optarg);
+        break;
+      case opt_transform_file:
+        {
+          std::ifstream t(optarg);
+          if (!t)
+            throw std::runtime_error(std::string("Cannot open transform file: ") + optarg);
+          std::string matrix((std::istreambuf_iterator<char>(t)), std::istreambuf_iterator<char>());
+          o.transform = parse_affine(matrix);
+        }
+        break;
       case 'c':
-        collapse_len = (float)atof(optarg);
+        o.collapse_len = (float)atof(optarg);
         break;
       case 'p':
-        collapse_perc = (float)atof(optarg);
+        o.collapse_perc = (float)atof(optarg);
         break;
       case 'v':
         {
-          // TODO deduplicate code with 's'
-          std::string sarg(optarg);
-          char delim = ',';
-          float v;
-
-          size_t dim = 0;
-          size_t pos = 0;
-          while((pos = sarg.find(delim)) != std::string::npos) {
-            v = (float)atof(sarg.substr(0,pos).c_str());
-            valid[dim++]=v;
-            sarg.erase(0,pos+1);
+          // Minimum bbox sizes and topology keywords, comma separated
+          std::istringstream sarg(optarg);
+          std::string token;
+          std::vector<float> sizes;
+          while (std::getline(sarg, token, ',')) {
+            switch (chash(token.c_str())) {
+            case chash("watertight"):
+              o.valid_watertight = true;
+              break;
+            case chash("manifold"):
+              o.valid_manifold = true;
+              break;
+            case chash("oriented"):
+              o.valid_oriented = true;
+              break;
+            default:
+              sizes.push_back((float)atof(token.c_str()));
+            }
           }
 
-          v = (float)atof(sarg.c_str());
-          while (dim<3)
-            valid[dim++]=v;
+          size_t dim = 0;
+          for (; dim<sizes.size() && dim<3; dim++)
+            o.valid[dim] = sizes[dim];
+          while (dim<3 && sizes.size())
+            o.valid[dim++] = sizes.back();
 
           break;
         }
+      case 'd':
+        o.cleanup = true;
+        break;
+      case 'n':
+        o.keep_normals = true;
+        break;
+      case 'z':
+        o.compress = true;
+        break;
+      case opt_checksum:
+        o.checksum = true;
+        break;
+      case opt_fec:
+        o.fec = (unsigned)atoi(optarg);
+        break;
+      case opt_scatter:
+        o.scatter = true;
+        break;
+      case opt_ply:
+        // Binary PLY output with the payload on vertices or faces
+        o.output = output_format::ply;
+        switch (chash(optarg)) {
+        case chash("vertex"):
+          o.ply_face_payload = false;
+          break;
+        case chash("face"):
+          o.ply_face_payload = true;
+          break;
+        default:
+          std::cerr << "Unknown ply payload element: " << optarg << std::endl;
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case opt_lsb:
+        {
+          // Mantissa bits per coordinate, normals also carry them when given
+          std::istringstream sarg(optarg);
+          std::string token;
+          while (std::getline(sarg, token, ','))
+            if (token=="normals")
+              o.lsb_normals = true;
+            else
+              o.lsb_bits = (unsigned)atoi(token.c_str());
+          break;
+        }
+      case opt_key_file:
+        {
+          std::ifstream t(optarg, std::ifstream::in | std::ifstream::binary);
+          if (!t)
+            throw std::runtime_error(std::string("Cannot read key file ") + optarg);
+          o.key = parse_key(std::string((std::istreambuf_iterator<char>(t)), std::istreambuf_iterator<char>()));
+        }
+        break;
+      case 'r':
+        o.reorder = true;
+        break;
+      case 'j':
+        o.threads = (size_t)atol(optarg);
+        break;
+      case 'w':
+        switch (chash(optarg)) {
+        case chash("map"):
+          o.strategy = weld_strategy::map;
+          break;
+        case chash("sort"):
+          o.strategy = weld_strategy::sort;
+          break;
+        case chash("grid"):
+          o.strategy = weld_strategy::grid;
+          break;
+        default:
+          std::cerr << "Unknown weld strategy: " << optarg << std::endl;
+          exit(EXIT_FAILURE);
+        }
+        break;
       default: /* '?' */
-        fprintf(stderr, "usage: %s [-x] [-a] [-h <header_string>] [-m <steno_msg>] [-f <steno_msg_file>] [-s <scale_factor>] [-c <collapse_length>] [-p <collapse_perc_smallest_bbox_edge>] [-v <validation_size>] < meshfile\n",
+        fprintf(stderr, "usage: %s [-x] [-a] [-h <header_string>] [-m <steno_msg>] [-f <steno_msg_file>] [-z] [--checksum] [--key-file <file>] [--fec <parity_percent>] [--scatter] [--lsb <bits>[,normals]] [--ply <vertex|face>] [-s <scale_factor>] [-t <m00,m01,...,m23> | --transform-file <file>] [-c <collapse_length>] [-p <collapse_perc_smallest_bbox_edge>] [-v <validation_size>[,watertight][,manifold][,oriented]] [--topology <file|->] [--trace <file>] [--perf-counters] [-w <map|sort|grid>] [-d] [-r] [-n] [-j <threads>] [--max-memory <bytes[K|M|G]>] [--serve <socket|->] [--probe] < meshfile\n"
+                "  --max-memory welds out of core with the map and sort strategies, -w grid always welds in core\n"
+                "  topology checks of STL input weld exact duplicates (-c 0) unless -c or -p is given\n",
                 argv[0]);
         exit(EXIT_FAILURE);
       }
     }
 
+    // Report the header properties as JSON
+    if (probe) {
+      std::cout << to_json(probe_mesh(std::cin, o)) << std::endl;
+      exit(EXIT_SUCCESS);
+    }
+
+    // Serve framed requests on a unix socket, or on stdin/stdout for '-'
+    if (serve=="-") {
+      serve_stream(STDIN_FILENO, STDOUT_FILENO, o);
+      exit(EXIT_SUCCESS);
+    }
+    if (serve.size()) {
+      serve_socket(serve, o, o.threads);
+      exit(EXIT_SUCCESS);
+    }
+
     if (!attr && (extract || steno_msg.size())) {
       std::cerr << "Only STL attribute encoding is currently supported, use the -a flag as it ensures backwards compatibility." << std::endl;
       exit(EXIT_FAILURE);
@@ -182,67 +364,53 @@ int main(int argc, char **argv)
 
       std::ifstream fs(meshfile, std::fstream::binary);
     */
-    Mesh<3> mesh;
-    std::string comment;
-
-    const size_t magic_byte_size = 5;
-    std::stringstream header_stream;
-    binary_read(std::cin, header_stream, magic_byte_size);
-    switch(chash(header_stream.str().c_str(), ' ')) {
-    case chash("ply"):
-    case chash("PLY"):
-      binary_read_until(std::cin, header_stream, "end_header");
-      header_stream.seekg(0);
-      mesh = parsePLY<Mesh<3>>(std::cin, header_stream);
-      break;
-    case chash("solid"):
-      std::getline(std::cin, comment);
-      mesh = parseSTL_ascii<Mesh<3>>(std::cin);
-      ltrim(comment);
-      mesh.comment = comment;
-      break;
-    default: // Assume binary STL
-      //read until 80 bytes
-      while((size_t)header_stream.tellp()<80 && !std::cin.eof())
-        header_stream.put(std::cin.get());
-      mesh = parseSTL<Mesh<3>>(std::cin, header_stream);
-      break;
-    }
+    pipeline_stats stats;
+    uint64_t facets = 0;
+    // The topology report, trace and counters are written also when a stage fails
+    auto report = [&stats, &topology_file, &trace_file, &perf, &facets]() {
+                    if (perf)
+                      perf_counters::instance().report(std::cerr, facets);
+                    if (trace_file.size()) {
+                      std::ofstream trace(trace_file);
+                      tracer::instance().write_json(trace);
+                    }
+                    if (topology_file.empty() || !stats.has_topology)
+                      return;
+                    if (topology_file=="-")
+                      std::cerr << to_json(stats.topology) << std::endl;
+                    else
+                      std::ofstream(topology_file) << to_json(stats.topology) << std::endl;
+                  };
+    try {
+      process(o, std::cin, [&](auto &mesh) {
+                             if (steno_msg.size()>0)
+                               set_payload(mesh, steno_msg, o);
+                             facets = triangle_count(mesh);
 
-    // Set the options for writing
-    if (header.size()>0)
-      mesh.comment = header;
-    if (steno_msg.size()>0)
-      mesh.steno_msg = steno_msg;
-
-    // Optionally merge close vertices
-    // TODO vertex merge currently does not support dist==0
-    if (!std::isnan(collapse_len) && collapse_len>0) {
-      vertex_merge(mesh, collapse_len);
-    }
-    if (!std::isnan(collapse_perc) && collapse_perc>0) {
-      auto bbox = bounding_box(mesh);
-      float min_edge_len = bbox[1].front()-bbox[0].front();
-      for (int i=1; i<3; i++) min_edge_len = std::min(min_edge_len, bbox[1][i]-bbox[0][i]);
-      // collapse_perc as % of min bbox dim
-      vertex_merge(mesh, collapse_perc/100 * min_edge_len);
+                             if (extract)
+                               std::cout << payload(mesh, o);
+                             else {
+                               write_output(mesh, std::cout, o);
+                               if (o.lsb_bits && steno_msg.size()>0) {
+                                 const auto bbox = bounding_box(mesh);
+                                 double diag = 0;
+                                 for (size_t a=0; a<3; a++)
+                                   diag += double(bbox[1][a]-bbox[0][a])*double(bbox[1][a]-bbox[0][a]);
+                                 const double bound = lsb_error_bound(bbox, o.lsb_bits);
+                                 std::cerr << "Mantissa payload moves vertices at most " << bound << " ("
+                                           << (diag>0? 100*bound/std::sqrt(diag) : 0) << "% of the bounding box diagonal)" << std::endl;
+                               }
+                             }
+                           }, stats);
     }
-
-    if (std::any_of(valid.cbegin(), valid.cend(), [](float f){ return f!=0; })) {
-      auto bbox = bounding_box(mesh); // TODO do not recalc if already calculated
-      int i=0;
-      if (std::any_of(valid.cbegin(), valid.cend(), [&i, &bbox](float f) {
-                                                      return bbox[1][i]-bbox[0][i++] < f;
-                                                    })) {
-        std::cerr << "Mesh validation failed" << std::endl;
-        exit(EXIT_FAILURE);
-      }
+    catch (...) {
+      report();
+      throw;
     }
-
-    if (extract)
-      std::cout << mesh.steno_msg;
-    else
-      writeSTL(mesh, scale, std::cout, ignore_length);
+    report();
+    if (o.cleanup)
+      std::cerr << "Removed " << stats.cleanup.degenerate << " degenerate and "
+                << stats.cleanup.duplicate << " duplicate faces" << std::endl;
 
     /* Other code omitted */
 
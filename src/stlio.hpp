@@ -18,67 +18,210 @@
 #define STLIO_HPP
 
 #include <iostream>
+#include <algorithm>
 #include <array>
 #include <sstream>
 #include <limits>
 #include <cmath>
+#include <cstring>
 
 #include "vertexio.hpp"
+#include "parallel.hpp"
+#include "meshproc.hpp"
+#include "payload.hpp"
 
 namespace stenomesh {
-  // TODO: face streaming?
-  // stl_stream >> face;
+  // Payload bytes as stored in the attribute bytes, see payload.hpp
+  struct stl_payload
+  {
+    std::string data;
+    uint32_t flags = 0;
+  };
+
+  // Binary STL facet record: normal, 3 vertices and the 2 attribute bytes
+  const size_t stl_record_size = 50;
+  const size_t stl_chunk_faces = 1<<14;
+
+  struct record_vertex_types
+  {
+    typedef uint32_t idx_t;
+    typedef std::vector<std::array<float,3>> vertices_t;
+  };
+
+  // Distinct corners of facet records numbered in order of first appearance, see facet_layout
+  class record_vertices
+  {
+    record_vertex_types::vertices_t _vertices;
+    exact_welder<record_vertex_types> _welder;
+
+  public:
+    const record_vertex_types::vertices_t& vertices() const { return _vertices; }
+    size_t size() const { return _vertices.size(); }
+
+    // Number of corner v, numbering it when new
+    uint32_t operator()(const std::array<float,3> &v) { return _welder(_vertices, v); }
+    // Number of a numbered corner, safe to call from several threads
+    uint32_t find(const std::array<float,3> &v) const { return _welder.find(_vertices, v); }
+  };
+
+  // Moves the units of bits each of records [from,n) from record order to their place,
+  // record from+f holding unit placement.pair(f) of a placement over the n-from records.
+  inline std::string place_units(const std::string &units, uint64_t from, uint64_t n, unsigned bits, facet_placement placement) {
+    n -= from;
+    placement.resize(n);
+    std::string placed((n*bits+7)/8+8, '\0');
+    for (uint64_t f=0; f<n; f++)
+      copy_bits(reinterpret_cast<unsigned char*>(&placed[0]), placement.pair(f)*bits,
+                reinterpret_cast<const unsigned char*>(units.data()), (from+f)*bits, bits);
+    return placed;
+  }
+
+  // Fec packets of records shifted off the placement blocks by dropped records, see facet_placement.
+  // The units of the n records are placed at each other block alignment when the placed stream misses
+  // packets and any alignment holds some within its first blocks, a stream without packets costs little.
+  inline std::string realigned_packets(const std::string &units, const std::string &placed, uint64_t n, unsigned bits,
+                                       const facet_placement &placement, uint32_t length_mask) {
+    const uint64_t blocks = 4;
+    std::string packets;
+    if (fec_complete(placed, length_mask))
+      return packets;
+    bool shifted = fec_packets(placed);
+    for (uint64_t a=1; !shifted && a<facet_placement::block_size && a<n; a++)
+      shifted = fec_packets(place_units(units, a, std::min(n, a+blocks*facet_placement::block_size), bits, placement));
+    for (uint64_t a=1; shifted && a<facet_placement::block_size && a<n; a++)
+      packets += fec_find_packets(place_units(units, a, n, bits, placement));
+    return packets;
+  }
+
+  // Distinct corners of the facets of mesh, see facet_layout
   template<typename Tmesh>
-  Tmesh parseSTL(std::istream &is, std::istream &header_stream) {
-    Tmesh mesh;
+  uint64_t stl_vertex_count(const Tmesh &mesh) {
+    record_vertices corners;
+    for_each_triangle(mesh, 0, triangle_count(mesh), [&](const auto &t) {
+        for (auto idx : t)
+          corners(mesh.vertices[idx]);
+      });
+    return corners.size();
+  }
 
+  // Streams the facets of a binary STL, calling count(n_faces) once and face(vertices, normal) per facet.
+  // Returns the payload stored in the facet records as described by layout.
+  template<typename Fcount, typename Fface>
+  stl_payload read_stl_facets(std::istream &is, std::istream &header_stream, Fcount count, Fface face, facet_layout layout = facet_layout()) {
     // 80 byte header
     std::array<char, 80> header;
     header_stream.read(header.data(), 80);
 
+    // The facet count follows the header, it is part of header_stream when that holds 84 bytes
     uint32_t n_faces;
-    is.read(reinterpret_cast<char*>(&n_faces), sizeof(n_faces)); // TODO big endian support
+    (header_stream.peek()==EOF? is : header_stream).read(reinterpret_cast<char*>(&n_faces), sizeof(n_faces)); // TODO big endian support
+    count(n_faces);
+    const unsigned unit_bits = layout.unit_bits(), vertex_bits = layout.vertex_bits();
+
+    // Unit bits of a facet record, see facet_layout, with slack for the bit string helpers
+    std::array<unsigned char, 16+8> unit;
+    auto read_unit = [&](const char *rec) {
+                       unit.fill(0);
+                       unit[0] = rec[48];
+                       unit[1] = rec[49];
+                       if (layout.lsb_bits && layout.lsb_normals)
+                         lsb_extract(reinterpret_cast<const unsigned char*>(rec), 3, layout.lsb_bits, unit.data()+2);
+                     };
+    // Bits grow as records arrive, n_faces is not validated yet
+    auto append_bits = [](std::string &bits, uint64_t bit, const unsigned char *src, unsigned n) {
+                         const size_t end = (bit+n+7)/8 + 8;
+                         if (bits.size()<end)
+                           bits.resize(std::max(end, 2*bits.size()));
+                         copy_bits(reinterpret_cast<unsigned char*>(&bits[0]), bit, src, 0, n);
+                       };
+    // The whole byte stream is kept, the length prefix can not be trusted before looking for fec packets.
+    // Units are collected in record order, vertex units in order of first appearance of the corners.
+    std::string units, vertex_units;
+    record_vertices corners;
+
+    std::array<char, stl_record_size> rec;
+    std::array<float, 3> normal;
+    std::array<std::array<float, 3>, 3> v;
 
-    union {
-      uint32_t num;
-      char data[sizeof(uint32_t)];
-    } steno_msg_size;
-    std::stringstream attr_stream;
+    uint32_t i = 0;
+    for (; i<n_faces && is.read(rec.data(), rec.size()); i++) {
+      std::memcpy(&normal, rec.data(), sizeof(normal));
+      std::memcpy(&v, rec.data()+sizeof(normal), sizeof(v));
 
-    std::array<float, 3> normal;
-    std::array<float, 3> v1;
-    std::array<float, 3> v2;
-    std::array<float, 3> v3;
-    std::array<char, 2> attr;
-
-    for (uint32_t i = 0; i<n_faces && is; i++) {
-      is.read(reinterpret_cast<char*>(&normal), sizeof(normal));
-      is.read(reinterpret_cast<char*>(&v1), sizeof(v1));
-      is.read(reinterpret_cast<char*>(&v2), sizeof(v2));
-      is.read(reinterpret_cast<char*>(&v3), sizeof(v3));
-
-      uint32_t idx = mesh.faces.size()*3;
-      mesh.faces.push_back({idx, idx+1, idx+2});
-      mesh.vertices.push_back(v1);
-      mesh.vertices.push_back(v2);
-      mesh.vertices.push_back(v3);
+      face(v, normal);
 
       // the attribute byte count does not signal any byte count.
       // it is used to encode color information (materialise) in just 2 bytes (5bit per color, 32768 colors)
       // stenomesh uses it to store steno messages
-      is.read(attr.data(), sizeof(attr));
-      if (i*2<sizeof(steno_msg_size.num)) {
-        steno_msg_size.data[i*2]  = attr[0];
-        steno_msg_size.data[i*2+1] = attr[1];
-      }
-      else if (i*2<steno_msg_size.num+sizeof(steno_msg_size.num)){
-        attr_stream.put(attr[0]);
-        attr_stream.put(attr[1]);
+      read_unit(rec.data());
+      append_bits(units, uint64_t(i)*unit_bits, unit.data(), unit_bits);
+      if (layout.lsb_bits)
+        for (const auto &corner : v) {
+          const size_t n = corners.size();
+          if (corners(corner)!=n)
+            continue;
+          std::array<unsigned char, 4+8> vertex_unit = {};
+          lsb_extract(reinterpret_cast<const unsigned char*>(corner.data()), 3, layout.lsb_bits, vertex_unit.data());
+          append_bits(vertex_units, n*vertex_bits, vertex_unit.data(), vertex_bits);
+        }
+    }
+
+    // Keyed placement moves the units read to their place, over the records read
+    const uint64_t n_vertices = corners.size();
+    std::string records;
+    if (layout.placement.keyed()) {
+      records.swap(units);
+      units = place_units(records, 0, i, unit_bits, layout.placement);
+      if (n_vertices)
+        vertex_units = place_units(vertex_units, 0, n_vertices, vertex_bits, layout.placement);
+    }
+    // Vertex units follow the facet units
+    if (n_vertices) {
+      const uint64_t bit = i*uint64_t(unit_bits);
+      units.resize(std::max<size_t>(units.size(), (bit+n_vertices*vertex_bits+7)/8+8));
+      copy_bits(reinterpret_cast<unsigned char*>(&units[0]), bit,
+                reinterpret_cast<const unsigned char*>(vertex_units.data()), 0, n_vertices*vertex_bits);
+    }
+    units.resize(std::min<uint64_t>(units.size(), layout.capacity(i, n_vertices)));
+    // Packets found at other alignments follow, at an even offset like the scan for them
+    if (layout.placement.keyed()) {
+      const std::string realigned = realigned_packets(records, units, i, unit_bits, layout.placement, payload_length_mask);
+      if (realigned.size()) {
+        units.resize((units.size()+1)/2*2);
+        units += realigned;
       }
     }
+    uint32_t flags;
+    std::string data = stored_payload(std::move(units), flags);
+    return { std::move(data), flags };
+  }
 
-    mesh.steno_msg = attr_stream.str().substr(0,steno_msg_size.num);
+  // Adds a parsed facet, normals are only kept when no face can be dropped by welding
+  template<typename Tmesh, typename Tinserter, typename Tface_vertices>
+  void insert_facet(Tmesh &mesh, Tinserter &insert, const Tface_vertices &v, const std::array<float,3> &normal, bool keep_normals) {
+    insert_face(mesh, insert, v);
+    if (keep_normals && !Tinserter::welds)
+      mesh.normals.push_back(normal);
+  }
 
+  // Vertices are added through insert, a welder merges them while parsing
+  // so only unique vertices are ever stored.
+  template<typename Tmesh, typename Tinserter = append_inserter<Tmesh>>
+  Tmesh parseSTL(std::istream &is, std::istream &header_stream, Tinserter insert = Tinserter(), bool keep_normals = false,
+                 const facet_layout &layout = facet_layout()) {
+    Tmesh mesh;
+    auto payload = read_stl_facets(is, header_stream,
+                                     // Closed meshes have about half as many vertices as faces,
+                                     // the hint is capped as n_faces is not validated yet
+                                     [&](uint32_t n_faces) {
+                                       insert.reserve(std::min<size_t>(n_faces, 1<<24)/2);
+                                       if (keep_normals)
+                                         mesh.normals.reserve(std::min<size_t>(n_faces, 1<<24));
+                                     },
+                                     [&](const auto &v, const auto &n) { insert_facet(mesh, insert, v, n, keep_normals); },
+                                     layout);
+    mesh.steno_msg = std::move(payload.data);
+    mesh.steno_flags = payload.flags;
     return mesh;
   }
 
@@ -101,33 +244,30 @@ namespace stenomesh {
     return is;
   }
 
-  template<typename Tmesh>
-  Tmesh parseSTL_ascii(std::istream &is) {
-    Tmesh mesh;
-
+  // Streams the facets of an ascii STL, calling face(vertices, normal) per facet
+  template<typename Fface>
+  void read_stl_ascii_facets(std::istream &is, Fface face) {
     std::array<float, 3> normal;
-    std::array<float, 3> v1;
-    std::array<float, 3> v2;
-    std::array<float, 3> v3;
+    std::array<std::array<float, 3>, 3> v;
 
     while (!is.eof()) {
       // read_next_vertex(std::istream& str, vertex_t& v)
       read_until(is, "normal");
+      if (is.eof()) break; // no facet after the last one
       vertexio::read_next_vertex(is, normal);
-      read_until(is, "vertex");
-      vertexio::read_next_vertex(is, v1);
-      read_until(is, "vertex");
-      vertexio::read_next_vertex(is, v2);
-      read_until(is, "vertex");
-      vertexio::read_next_vertex(is, v3);
-
-      uint32_t idx = mesh.faces.size()*3;
-      mesh.faces.push_back({idx, idx+1, idx+2});
-      mesh.vertices.push_back(v1);
-      mesh.vertices.push_back(v2);
-      mesh.vertices.push_back(v3);
+      for (auto &vertex : v) {
+        read_until(is, "vertex");
+        vertexio::read_next_vertex(is, vertex);
+      }
+
+      face(v, normal);
     }
+  }
 
+  template<typename Tmesh, typename Tinserter = append_inserter<Tmesh>>
+  Tmesh parseSTL_ascii(std::istream &is, Tinserter insert = Tinserter(), bool keep_normals = false) {
+    Tmesh mesh;
+    read_stl_ascii_facets(is, [&](const auto &v, const auto &n) { insert_facet(mesh, insert, v, n, keep_normals); });
     return mesh;
   }
 
@@ -137,6 +277,8 @@ namespace stenomesh {
     V b = { v2[0]-origin[0], v2[1]-origin[1], v2[2]-origin[2] };
     V cross = { a[1]*b[2] - a[2]*b[1], a[2]*b[0] - a[0]*b[2], a[0]*b[1] - a[1]*b[0] };
     auto length = std::sqrt(cross[0]*cross[0] + cross[1]*cross[1] + cross[2]*cross[2]);
+    if (!(length>0)) // zero area facet, no defined normal
+      return { 0, 0, 0 };
     return { cross[0]/length,  cross[1]/length, cross[2]/length };
   }
 
@@ -145,46 +287,138 @@ namespace stenomesh {
     return { vertex[0]*scale[0], vertex[1]*scale[1], vertex[2]*scale[2] };
   }
 
-  template<typename Tmesh>
-  std::ostream& writeSTL(Tmesh mesh, std::array<float,3> scale, std::ostream &os, bool ignore_msg_length = false) {
+  // Writes a binary STL of face_cnt facets. facets(begin, end, f) calls f(v0, v1, v2, normal) for the
+  // facets [begin,end) in order, it is called from worker threads for disjoint ranges.
+  // normal points to the facet normal to write unchanged, nullptr to calculate it.
+  // layout places the payload in the records after scaling and normal calculation, facets is called
+  // once more beforehand to number the corners when it holds mantissa bits.
+  template<typename Ffacets>
+  std::ostream& write_stl_facets(std::ostream &os, const std::string &comment, const std::string &steno_msg, uint32_t steno_flags, size_t n_faces,
+                                 Ffacets facets, std::array<float,3> scale, bool ignore_msg_length = false, size_t threads = 1,
+                                 facet_layout layout = facet_layout()) {
     std::array<char,80> header;
     header.fill(0);
-    mesh.comment.copy(header.data(), 80);
+    comment.copy(header.data(), 80);
     os.write(header.data(), 80);
 
-    uint32_t face_cnt = mesh.faces.size();
+    if (n_faces > std::numeric_limits<uint32_t>::max())
+      throw std::runtime_error("Face count exceeds the binary STL limit");
+    uint32_t face_cnt = n_faces;
     os.write(reinterpret_cast<char*>(&face_cnt), sizeof(face_cnt));
-
-    if (!ignore_msg_length && mesh.steno_msg.size()>std::min(face_cnt*2-(int)sizeof(uint32_t),std::numeric_limits<uint32_t>::max()))
-      throw std::runtime_error("Steno message overflows the available storage space");
-    std::stringstream steno_stream;
-    uint32_t msg_size = mesh.steno_msg.size();
-    steno_stream.write(reinterpret_cast<char*>(&msg_size), sizeof(msg_size));
-    steno_stream.write(mesh.steno_msg.c_str(),msg_size);
-
-    std::array<char,2> attr_byte_cnt;
-
+    layout.placement.resize(face_cnt);
+    const unsigned unit_bits = layout.unit_bits(), vertex_bits = layout.vertex_bits();
     bool invert = scale[0]*scale[1]*scale[2] < 0;
-    for (auto f : mesh.faces) {
-      auto v0 = apply_scale(mesh.vertices[f[invert? 1:0]], scale);
-      auto v1 = apply_scale(mesh.vertices[f[invert? 0:1]], scale);
-      auto v2 = apply_scale(mesh.vertices[f[2]], scale);
-      auto normal = cross_product(v0, v1, v2);
-
-      os.write(reinterpret_cast<char*>(normal.data()), sizeof(normal));
-      os.write(reinterpret_cast<char*>(&(v0)), sizeof(normal));
-      os.write(reinterpret_cast<char*>(&(v1)), sizeof(normal));
-      os.write(reinterpret_cast<char*>(&(v2)), sizeof(normal));
-
-      // Set non used attr byte counts to white after end of message (displays nicer in meshlab)
-      attr_byte_cnt.fill(msg_size? -1 : 0); // -1 = white according to meshlab
-      if (!steno_stream.eof())
-        steno_stream.read(attr_byte_cnt.data(),2);
-      os.write(attr_byte_cnt.data(), sizeof(attr_byte_cnt));
+
+    // Distinct corners of the records are numbered before any is written
+    record_vertices corners;
+    if (layout.lsb_bits)
+      for (size_t begin=0; begin<face_cnt; begin+=stl_chunk_faces)
+        facets(begin, std::min<size_t>(face_cnt, begin+stl_chunk_faces), [&](const auto &a, const auto &b, const auto &c, const auto *) {
+            corners(apply_scale(invert? b : a, scale));
+            corners(apply_scale(invert? a : b, scale));
+            corners(apply_scale(c, scale));
+          });
+    const uint64_t capacity = layout.capacity(face_cnt, corners.size());
+
+    // Face layout.placement.facet(i) holds the payload bits [i*unit_bits, (i+1)*unit_bits), the vertex units follow
+    std::string payload = payload_bytes(steno_msg, steno_flags, capacity, ignore_msg_length);
+    uint32_t msg_size = steno_msg.size();
+    // Set non used attr byte counts to white after end of message (displays nicer in meshlab)
+    const char attr_fill = msg_size? -1 : 0; // -1 = white according to meshlab
+    // Units beyond the end are not written, partial ones are completed with fill bits
+    const uint64_t payload_bits = 8*uint64_t(payload.size());
+    payload.append(16, attr_fill);
+    const unsigned char *payload_data = reinterpret_cast<const unsigned char*>(payload.data());
+
+    // Corner r holds vertex unit vertex_placement.pair(r), its records all write the same embedded coordinates.
+    // The reader numbers the embedded corners, they must stay distinct.
+    std::vector<std::array<float,3>> embedded;
+    if (layout.lsb_bits) {
+      facet_placement vertex_placement = layout.placement;
+      vertex_placement.resize(corners.size());
+      embedded = corners.vertices();
+      record_vertices distinct;
+      for (uint32_t r=0; r<embedded.size(); r++) {
+        const uint64_t bit = uint64_t(face_cnt)*unit_bits + vertex_placement.pair(r)*vertex_bits;
+        if (bit<payload_bits) {
+          std::array<unsigned char, 4+8> vertex_unit = {};
+          or_bits(vertex_unit.data(), 0, get_bits(payload_data, bit, vertex_bits));
+          lsb_embed(reinterpret_cast<unsigned char*>(embedded[r].data()), 3, layout.lsb_bits, vertex_unit.data());
+        }
+        if (distinct(embedded[r])!=r)
+          throw std::runtime_error("Mantissa payload bits merge distinct vertices, embed fewer bits");
+      }
     }
 
+    auto format = [&](size_t chunk, std::vector<char> &buffer) {
+                    size_t begin = chunk*stl_chunk_faces;
+                    size_t end = std::min<size_t>(face_cnt, begin+stl_chunk_faces);
+                    buffer.resize((end-begin)*stl_record_size);
+                    char* rec = buffer.data();
+                    size_t i = begin;
+                    std::array<unsigned char, 16+8> unit; // see read_stl_facets
+                    facets(begin, end, [&](const auto &a, const auto &b, const auto &c, const auto *n) {
+                        auto v0 = apply_scale(invert? b : a, scale);
+                        auto v1 = apply_scale(invert? a : b, scale);
+                        auto v2 = apply_scale(c, scale);
+                        auto normal = n? *n : cross_product(v0, v1, v2);
+                        if (layout.lsb_bits) {
+                          v0 = embedded[corners.find(v0)];
+                          v1 = embedded[corners.find(v1)];
+                          v2 = embedded[corners.find(v2)];
+                        }
+
+                        std::memcpy(rec, normal.data(), 12);
+                        std::memcpy(rec+12, v0.data(), 12);
+                        std::memcpy(rec+24, v1.data(), 12);
+                        std::memcpy(rec+36, v2.data(), 12);
+                        const uint64_t bit = layout.placement.pair(i)*unit_bits;
+                        if (bit<payload_bits) {
+                          unit.fill(0);
+                          or_bits(unit.data(), 0, get_bits(payload_data, bit, unit_bits));
+                          rec[48] = unit[0];
+                          rec[49] = unit[1];
+                          if (layout.lsb_bits && layout.lsb_normals)
+                            lsb_embed(reinterpret_cast<unsigned char*>(rec), 3, layout.lsb_bits, unit.data()+2);
+                        }
+                        else
+                          rec[48] = rec[49] = attr_fill;
+                        rec += stl_record_size;
+                        i++;
+                      });
+                  };
+    auto write = [&os](size_t, const std::vector<char> &buffer) {
+                   os.write(buffer.data(), buffer.size());
+                 };
+    size_t n_chunks = (face_cnt+stl_chunk_faces-1)/stl_chunk_faces;
+    ordered_chunks<std::vector<char>>(n_chunks, threads, format, write);
+
     return os;
   }
+
+  // Polygons are written as fans of triangles.
+  // Kept input normals are written unchanged when the geometry is not scaled.
+  template<typename Tmesh>
+  std::ostream& writeSTL(const Tmesh &mesh, std::array<float,3> scale, std::ostream &os, bool ignore_msg_length = false, size_t threads = 1,
+                         const facet_layout &layout = facet_layout()) {
+    const bool identity = scale[0]==1 && scale[1]==1 && scale[2]==1;
+    const auto *normals = identity? input_normals(mesh) : nullptr;
+    auto facets = [&mesh, normals](size_t begin, size_t end, auto f) {
+                    size_t i = begin;
+                    for_each_triangle(mesh, begin, end, [&](const auto &t) {
+                        f(mesh.vertices[t[0]], mesh.vertices[t[1]], mesh.vertices[t[2]], normals? normals+i : nullptr);
+                        i++;
+                      });
+                  };
+    return write_stl_facets(os, mesh.comment, mesh.steno_msg, mesh.steno_flags, triangle_count(mesh), facets, scale, ignore_msg_length, threads, layout);
+  }
+
+  // Writes the mesh geometry unchanged
+  template<typename Tmesh>
+  std::ostream& writeSTL(const Tmesh &mesh, std::ostream &os, bool ignore_msg_length = false, size_t threads = 1,
+                         const facet_layout &layout = facet_layout()) {
+    return writeSTL(mesh, {1,1,1}, os, ignore_msg_length, threads, layout);
+  }
 }
 
 #endif // STLIO_HPP
@@ -0,0 +1,191 @@
+// Copyright (C) 2019 hrobeers (https://github.com/hrobeers)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef TOPOLOGY_HPP
+#define TOPOLOGY_HPP
+
+#include <array>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "meshproc.hpp"
+#include "radixsort.hpp"
+#include "parallel.hpp"
+
+namespace stenomesh {
+  struct topology_stats
+  {
+    size_t triangles = 0;
+    size_t vertices = 0;            // used by at least one triangle
+    size_t edges = 0;
+    size_t boundary_edges = 0;      // used by one triangle
+    size_t non_manifold_edges = 0;  // used by more than two triangles
+    size_t inconsistent_edges = 0;  // two triangles traversing the edge in the same direction
+    size_t components = 0;          // vertex connected components
+
+    bool manifold() const { return non_manifold_edges==0; }
+    bool watertight() const { return boundary_edges==0 && non_manifold_edges==0; }
+    bool oriented() const { return inconsistent_edges==0; }
+    // V - E + F, 2 per closed genus 0 component
+    int64_t euler() const { return int64_t(vertices) - int64_t(edges) + int64_t(triangles); }
+  };
+
+  // Edge topology of the triangles, polygons count as their triangle fans.
+  // Topology follows vertex indices, so unindexed meshes need welding first.
+  // Directed edges are radix sorted on their (min, max) vertex pair, equal runs form the
+  // undirected edges. Components are joined by a lock free union find over the vertices.
+  template<typename TMesh>
+  topology_stats check_topology(const TMesh &mesh, size_t threads = 1) {
+    typedef typename TMesh::idx_t idx_t;
+    typedef std::array<idx_t,2> edge_t;
+    topology_stats stats;
+    const size_t n_tri = triangle_count(mesh);
+    const size_t n_vtx = mesh.vertices.size();
+    stats.triangles = n_tri;
+
+    // Union find with parents linking from the higher to the lower index
+    std::unique_ptr<std::atomic<idx_t>[]> parent(new std::atomic<idx_t>[n_vtx]);
+    std::unique_ptr<std::atomic<bool>[]> used(new std::atomic<bool>[n_vtx]);
+    parallel_for(n_vtx, threads, [&](size_t begin, size_t end) {
+                                   for (size_t v=begin; v<end; v++) {
+                                     parent[v].store(idx_t(v), std::memory_order_relaxed);
+                                     used[v].store(false, std::memory_order_relaxed);
+                                   }
+                                 });
+    auto find = [&parent](idx_t v) {
+                  idx_t p;
+                  while ((p = parent[v].load(std::memory_order_relaxed))!=v) {
+                    idx_t gp = parent[p].load(std::memory_order_relaxed);
+                    if (gp!=p)
+                      parent[v].compare_exchange_weak(p, gp, std::memory_order_relaxed);
+                    v = gp;
+                  }
+                  return v;
+                };
+    auto unite = [&](idx_t a, idx_t b) {
+                   while (true) {
+                     a = find(a);
+                     b = find(b);
+                     if (a==b) return;
+                     if (a<b) std::swap(a, b);
+                     idx_t expected = a;
+                     if (parent[a].compare_exchange_strong(expected, b, std::memory_order_relaxed))
+                       return;
+                   }
+                 };
+
+    // Directed edges, skipping those of collapsed triangles
+    std::vector<keyed<edge_t>> items(3*n_tri);
+    std::vector<char> valid(3*n_tri);
+    parallel_for(n_tri, threads, [&](size_t begin, size_t end) {
+                                   size_t e = 3*begin;
+                                   for_each_triangle(mesh, begin, end, [&](const auto &t) {
+                                       for (size_t k=0; k<3; k++, e++) {
+                                         idx_t from = t[k], to = t[(k+1)%3];
+                                         items[e] = { uint64_t(std::max(from, to)), { from, to } };
+                                         valid[e] = from!=to;
+                                         used[from].store(true, std::memory_order_relaxed);
+                                       }
+                                       unite(t[0], t[1]);
+                                       unite(t[1], t[2]);
+                                     });
+                                 });
+    items = parallel_filter(items, threads, [&valid](size_t i) { return valid[i]!=0; });
+    valid = std::vector<char>();
+
+    // Edges are sorted on their (min, max) pair, packed in one key when indices fit 32 bits
+    // or in stable passes on max then min otherwise
+    const size_t n = items.size();
+    const bool packed = n_vtx <= (uint64_t(1)<<32);
+    parallel_for(n, threads, [&](size_t begin, size_t end) {
+                               for (size_t i=begin; i<end; i++) {
+                                 uint64_t lo = std::min(items[i].val[0], items[i].val[1]);
+                                 items[i].key = packed? lo<<32 | items[i].key : items[i].key;
+                               }
+                             });
+    radix_sort(items, threads);
+    if (!packed) {
+      parallel_for(n, threads, [&](size_t begin, size_t end) {
+                                 for (size_t i=begin; i<end; i++)
+                                   items[i].key = std::min(items[i].val[0], items[i].val[1]);
+                               });
+      radix_sort(items, threads);
+    }
+
+    auto same_edge = [&items](size_t i, size_t j) {
+                       return items[i].key==items[j].key &&
+                         std::max(items[i].val[0], items[i].val[1])==std::max(items[j].val[0], items[j].val[1]);
+                     };
+    const size_t parts = std::min(thread_count(threads), std::max<size_t>(1, n/(1<<16)));
+    const size_t range = (n+parts-1)/parts;
+    std::vector<topology_stats> part_stats(parts);
+    parallel_for(parts, parts, [&](size_t pbegin, size_t pend) {
+                                 for (size_t p=pbegin; p<pend; p++) {
+                                   // Parts start and end on run boundaries
+                                   size_t begin = std::min(n, p*range);
+                                   size_t end = std::min(n, (p+1)*range);
+                                   while (begin>0 && begin<n && same_edge(begin-1, begin)) begin++;
+                                   while (end<n && end>0 && same_edge(end-1, end)) end++;
+                                   auto &s = part_stats[p];
+                                   for (size_t b=begin, e; b<end; b=e) {
+                                     for (e=b+1; e<n && same_edge(b, e); e++);
+                                     s.edges++;
+                                     if (e-b==1)
+                                       s.boundary_edges++;
+                                     else if (e-b>2)
+                                       s.non_manifold_edges++;
+                                     else if (items[b].val[0]==items[b+1].val[0])
+                                       s.inconsistent_edges++;
+                                   }
+                                 }
+                               }, 1);
+    for (const auto &s : part_stats) {
+      stats.edges += s.edges;
+      stats.boundary_edges += s.boundary_edges;
+      stats.non_manifold_edges += s.non_manifold_edges;
+      stats.inconsistent_edges += s.inconsistent_edges;
+    }
+
+    for (size_t v=0; v<n_vtx; v++)
+      if (used[v].load(std::memory_order_relaxed)) {
+        stats.vertices++;
+        stats.components += find(idx_t(v))==v;
+      }
+    return stats;
+  }
+
+  inline std::string to_json(const topology_stats &stats) {
+    std::ostringstream os;
+    os << "{\"triangles\":" << stats.triangles
+       << ",\"vertices\":" << stats.vertices
+       << ",\"edges\":" << stats.edges
+       << ",\"boundary_edges\":" << stats.boundary_edges
+       << ",\"non_manifold_edges\":" << stats.non_manifold_edges
+       << ",\"inconsistent_edges\":" << stats.inconsistent_edges
+       << ",\"components\":" << stats.components
+       << ",\"euler\":" << stats.euler()
+       << ",\"watertight\":" << (stats.watertight()? "true" : "false")
+       << ",\"manifold\":" << (stats.manifold()? "true" : "false")
+       << ",\"oriented\":" << (stats.oriented()? "true" : "false")
+       << "}";
+    return os.str();
+  }
+}
+
+#endif // TOPOLOGY_HPP
@@ -0,0 +1,132 @@
+// Copyright (C) 2019 hrobeers (https://github.com/hrobeers)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace stenomesh {
+  // Timing spans in Chrome trace format (chrome://tracing, Perfetto).
+  // Every thread appends to its own buffer, only registering a new thread takes a lock.
+  // Tracing is off unless enabled, a disabled span costs one relaxed load.
+  class tracer
+  {
+  public:
+    struct event
+    {
+      const char *name;
+      uint64_t begin;
+      uint64_t end;
+    };
+
+    static tracer& instance() {
+      static tracer t;
+      return t;
+    }
+
+    // The enabling thread is traced as main
+    void enable() {
+      _start = now();
+      thread_events();
+      _enabled.store(true, std::memory_order_relaxed);
+    }
+
+    bool enabled() const {
+      return _enabled.load(std::memory_order_relaxed);
+    }
+
+    static uint64_t now() {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void record(const char *name, uint64_t begin, uint64_t end) {
+      thread_events().push_back({ name, begin, end });
+    }
+
+    // Call once all traced threads are joined
+    void write_json(std::ostream &os) {
+      std::lock_guard<std::mutex> lock(_mtx);
+      os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+      bool first = true;
+      for (size_t tid=0; tid<_threads.size(); tid++) {
+        os << (first? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+           << ",\"args\":{\"name\":\"" << (tid? "worker " + std::to_string(tid) : std::string("main")) << "\"}}";
+        first = false;
+        for (const auto &e : _threads[tid])
+          os << ",\n{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+             << ",\"ts\":" << micros(e.begin-_start) << ",\"dur\":" << micros(e.end-e.begin) << "}";
+      }
+      os << "\n]}\n";
+    }
+
+  private:
+    tracer() = default;
+
+    // Microseconds with the nanoseconds as 3 decimals, exact whatever the run time
+    static std::string micros(uint64_t ns) {
+      const std::string frac = std::to_string(ns%1000);
+      return std::to_string(ns/1000) + "." + std::string(3-frac.size(), '0') + frac;
+    }
+
+    std::vector<event>& thread_events() {
+      thread_local std::vector<event> *events = nullptr;
+      if (!events) {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _threads.emplace_back();
+        _threads.back().reserve(1<<10);
+        events = &_threads.back();
+      }
+      return *events;
+    }
+
+    std::atomic<bool> _enabled{false};
+    uint64_t _start = 0;
+    std::mutex _mtx;
+    std::deque<std::vector<event>> _threads; // stable addresses, outlive their threads
+  };
+
+  // Records the lifetime of the span when tracing is enabled, name must be a string literal
+  class trace_span
+  {
+  public:
+    explicit trace_span(const char *name) : _name(name), _begin(tracer::instance().enabled()? tracer::now() : 0) {}
+
+    ~trace_span() { end(); }
+
+    // Ends the span before the end of its scope
+    void end() {
+      if (_begin)
+        tracer::instance().record(_name, _begin, tracer::now());
+      _begin = 0;
+    }
+
+    trace_span(const trace_span&) = delete;
+    trace_span& operator=(const trace_span&) = delete;
+
+  private:
+    const char *_name;
+    uint64_t _begin;
+  };
+}
+
+#endif // TRACE_HPP
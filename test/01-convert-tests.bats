@@ -65,3 +65,110 @@ DD=${BATS_TEST_DIRNAME}/data
 
     [[ $result == *"Bounding Box Size 1000.000000  1000.000000  1000.000000"* ]]
 }
+
+@test "convert: parallel writer matches serial writer" {
+    # 79202 faces -> multiple write chunks
+    serial=$(${BATS_TEST_DIRNAME}/gen_grid.sh 200 | ${BD}/stenomesh -j 1 -am "hello grid" | sha1sum | awk '{print $1}')
+    parallel=$(${BATS_TEST_DIRNAME}/gen_grid.sh 200 | ${BD}/stenomesh -j 4 -am "hello grid" | sha1sum | awk '{print $1}')
+
+    # Verify
+    [ $serial == "ebb2c896271ac48a65cfb50cb73ecfe0de8519bf" ]
+    [ $parallel == $serial ]
+}
+
+@test "convert: ascii stl facet count" {
+    # seam_ascii.stl holds 2 facets
+    result=$(cat ${DD}/seam_ascii.stl | ${BD}/stenomesh | head -c 84 | tail -c 4 | od -An -tu4 | tr -d ' ')
+
+    # Verify
+    [ $result == 2 ]
+}
+
+@test "convert: reorder keeps faces and payload" {
+    serial=$(${BATS_TEST_DIRNAME}/gen_grid.sh 200 | ${BD}/stenomesh -r -j 1 -am "hello grid" | sha1sum | awk '{print $1}')
+    parallel=$(${BATS_TEST_DIRNAME}/gen_grid.sh 200 | ${BD}/stenomesh -r -j 4 -am "hello grid" | sha1sum | awk '{print $1}')
+    count=$(${BATS_TEST_DIRNAME}/gen_grid.sh 200 | ${BD}/stenomesh -r | head -c 84 | tail -c 4 | od -An -tu4 | tr -d ' ')
+    message=$(${BATS_TEST_DIRNAME}/gen_grid.sh 200 | ${BD}/stenomesh -r -am "hello grid" | ${BD}/stenomesh -ax)
+
+    # Verify
+    [ $parallel == $serial ]
+    [ $count == 79202 ]
+    [ "${message}" == "hello grid" ]
+}
+
+@test "convert: quad ply to stl" {
+    result=$(cat ${DD}/cube_quads_ascii.ply | ${BD}/stenomesh | sha1sum | awk '{print $1}')
+    count=$(cat ${DD}/cube_quads_ascii.ply | ${BD}/stenomesh | head -c 84 | tail -c 4 | od -An -tu4 | tr -d ' ')
+
+    # Verify 6 quads are written as 12 triangles
+    [ $result == "db3e558796a2f382850d65a3d963dda6267affb1" ]
+    [ $count == 12 ]
+}
+
+@test "convert: big endian binary quad ply to stl" {
+    # double coordinates, ushort list counts and extra properties to skip
+    result=$(cat ${DD}/cube_quads_bin_be.ply | ${BD}/stenomesh | sha1sum | awk '{print $1}')
+
+    # Verify
+    [ $result == "db3e558796a2f382850d65a3d963dda6267affb1" ]
+}
+
+@test "convert: malformed ply faces are refused" {
+    # negative list count
+    run bash -c "sed 's/^4 4 5 6 7$/-4 4 5 6 7/' ${DD}/cube_quads_ascii.ply | ${BD}/stenomesh"
+    [ $status -ne 0 ]
+    [[ "$output" == *"Negative ply list count"* ]]
+
+    # vertex indices that are not a list
+    run bash -c "sed 's/^property list uchar int vertex_indices$/property int vertex_indices/' ${DD}/cube_quads_ascii.ply | ${BD}/stenomesh"
+    [ $status -ne 0 ]
+    [[ "$output" == *"Face vertex indices are not a list"* ]]
+}
+
+@test "convert: quad ply through triangle stages" {
+    # welding triangulates the polygons before writing
+    result=$(cat ${DD}/cube_quads_ascii.ply | ${BD}/stenomesh -c 0 | sha1sum | awk '{print $1}')
+
+    # Verify
+    [ $result == "db3e558796a2f382850d65a3d963dda6267affb1" ]
+}
+
+@test "convert: keep input normals" {
+    # facet normals were replaced by (0.5, 0.25, facet index)
+    input=$(tail -c +81 ${DD}/cube_normals_bin.stl | sha1sum | awk '{print $1}')
+    kept=$(cat ${DD}/cube_normals_bin.stl | ${BD}/stenomesh -n | tail -c +81 | sha1sum | awk '{print $1}')
+    scaled=$(cat ${DD}/cube_normals_bin.stl | ${BD}/stenomesh -n -s 2 | tail -c +81 | sha1sum | awk '{print $1}')
+
+    # Verify
+    [ $kept == $input ]
+    [ $scaled != $input ]
+}
+
+@test "convert: zero area facet normal" {
+    # the first facet has 3 equal vertices
+    result=$(cat ${DD}/cube_normals_bin.stl | ${BD}/stenomesh | head -c 96 | tail -c 12 | od -An -tf4 | tr -s ' ')
+
+    # Verify
+    [ "${result}" == " 0 0 0" ]
+}
+
+@test "convert: transform matches scale" {
+    scaled=$(cat ${DD}/cube_bin.ply | ${BD}/stenomesh -s 2,3,-1 | sha1sum | awk '{print $1}')
+    transformed=$(cat ${DD}/cube_bin.ply | ${BD}/stenomesh -t 2,0,0,0,0,3,0,0,0,0,-1,0 | sha1sum | awk '{print $1}')
+
+    # Verify
+    [ $transformed == $scaled ]
+}
+
+@test "convert: transform from file" {
+    matrix=$(mktemp -t stenomesh.test.XXXXXXXXX)
+    printf "0 -1 0 5\n1 0 0 -2\n0 0 1 0.5\n" > $matrix
+    direct=$(cat ${DD}/cube_bin.ply | ${BD}/stenomesh -t "0,-1,0,5,1,0,0,-2,0,0,1,0.5" | sha1sum | awk '{print $1}')
+    file=$(cat ${DD}/cube_bin.ply | ${BD}/stenomesh --transform-file $matrix | sha1sum | awk '{print $1}')
+    plain=$(cat ${DD}/cube_bin.ply | ${BD}/stenomesh | sha1sum | awk '{print $1}')
+    rm $matrix
+
+    # Verify
+    [ $file == $direct ]
+    [ $file != $plain ]
+}
@@ -50,3 +50,189 @@ DD=${BATS_TEST_DIRNAME}/data
     # Verify decoded value
     [ "${result}" == "${message}" ]
 }
+
+@test "attr encoding: compressed message beyond raw capacity" {
+    # 60 bytes do not fit the 20 byte encoding space uncompressed
+    message=$(printf 'ab%.0s' $(seq 30))
+    ! (cat ${DD}/cube_bin.ply | ${BD}/stenomesh -am "${message}" > /dev/null 2>&1)
+    result=$(cat ${DD}/cube_bin.ply | ${BD}/stenomesh -azm "${message}" | ${BD}/stenomesh -ax)
+
+    # Verify decoded value
+    [ "${result}" == "${message}" ]
+}
+
+@test "attr encoding: incompressible message stored as is" {
+    message="hello world"
+    result=$(cat ${DD}/cube_bin.ply | ${BD}/stenomesh -azm "${message}" | ${BD}/stenomesh --probe)
+
+    # Verify
+    [ "${result}" == '{"format":"stl_binary","faces":12,"vertices":36,"comment":"VCGLIB generated\n","capacity":20,"payload":true,"payload_length":11}' ]
+}
+
+@test "attr encoding: checksum" {
+    message="hello"
+    result=$(cat ${DD}/cube_bin.ply | ${BD}/stenomesh -am "${message}" --checksum | ${BD}/stenomesh -ax)
+
+    # Verify decoded value
+    [ "${result}" == "${message}" ]
+
+    # Flip a bit of the message in the attribute bytes of the 4th facet
+    cat ${DD}/cube_bin.ply | ${BD}/stenomesh -am "${message}" --checksum > ${BATS_TMPDIR}/stenomesh_crc.stl
+    printf '\x00' | dd of=${BATS_TMPDIR}/stenomesh_crc.stl bs=1 seek=$((84+3*50+48)) conv=notrunc 2>/dev/null
+    ! (cat ${BATS_TMPDIR}/stenomesh_crc.stl | ${BD}/stenomesh -ax > /dev/null 2>&1)
+}
+
+@test "attr encoding: checksum of a long message" {
+    # Several KB run the crc over many 8 byte steps
+    message=$(head -c 3000 /dev/urandom | base64 -w 0)
+    ${BATS_TEST_DIRNAME}/gen_grid.sh 60 | ${BD}/stenomesh -am "${message}" --checksum > ${BATS_TMPDIR}/stenomesh_crc_long.stl
+    result=$(cat ${BATS_TMPDIR}/stenomesh_crc_long.stl | ${BD}/stenomesh -ax)
+
+    # Verify decoded value
+    [ "${result}" == "${message}" ]
+
+    # Flip a message bit far from the start
+    printf '\x00' | dd of=${BATS_TMPDIR}/stenomesh_crc_long.stl bs=1 seek=$((84+1500*50+48)) conv=notrunc 2>/dev/null
+    ! (cat ${BATS_TMPDIR}/stenomesh_crc_long.stl | ${BD}/stenomesh -ax > /dev/null 2>&1)
+}
+
+@test "attr encoding: encrypted message" {
+    message="hello world"
+    key=000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f
+    printf '%s\n' ${key} > ${BATS_TMPDIR}/stenomesh.key
+    ${BATS_TEST_DIRNAME}/gen_grid.sh 8 | ${BD}/stenomesh -azm "${message}" --checksum --key-file ${BATS_TMPDIR}/stenomesh.key > ${BATS_TMPDIR}/stenomesh_enc.stl
+
+    # Verify, the key is needed and may come from the environment
+    result=$(cat ${BATS_TMPDIR}/stenomesh_enc.stl | ${BD}/stenomesh -ax --key-file ${BATS_TMPDIR}/stenomesh.key)
+    [ "${result}" == "${message}" ]
+    result=$(cat ${BATS_TMPDIR}/stenomesh_enc.stl | STENOMESH_KEY=${key} ${BD}/stenomesh -ax)
+    [ "${result}" == "${message}" ]
+    ! (cat ${BATS_TMPDIR}/stenomesh_enc.stl | ${BD}/stenomesh -ax > /dev/null 2>&1)
+    ! (cat ${BATS_TMPDIR}/stenomesh_enc.stl | ${BD}/stenomesh -ax | grep -q "${message}")
+}
+
+@test "attr encoding: encrypted long message" {
+    # Over 512 bytes, the whole keystream is generated 8 and 4 blocks at a time
+    message=$(head -c 600 /dev/urandom | base64 -w 0)
+    key=000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f
+    ${BATS_TEST_DIRNAME}/gen_grid.sh 30 | STENOMESH_KEY=${key} ${BD}/stenomesh -am "${message}" > ${BATS_TMPDIR}/stenomesh_enc_long.stl
+
+    # Verify
+    result=$(cat ${BATS_TMPDIR}/stenomesh_enc_long.stl | STENOMESH_KEY=${key} ${BD}/stenomesh -ax)
+    [ "${result}" == "${message}" ]
+    ! (cat ${BATS_TMPDIR}/stenomesh_enc_long.stl | ${BD}/stenomesh -ax | grep -q "${message}")
+}
+
+@test "attr encoding: error correction of dropped facets" {
+    message=$(head -c 3000 ${BATS_TEST_DIRNAME}/../src/fec.hpp)
+    ${BATS_TEST_DIRNAME}/gen_grid.sh 40 | ${BD}/stenomesh -am "${message}" --fec 50 > ${BATS_TMPDIR}/stenomesh_fec.stl
+    result=$(cat ${BATS_TMPDIR}/stenomesh_fec.stl | ${BD}/stenomesh -ax)
+    [ "${result}" == "${message}" ]
+
+    # Drop the first 3 and 20 facets further on, fixing the facet count
+    n=$(($(od -An -tu4 -j80 -N4 ${BATS_TMPDIR}/stenomesh_fec.stl)-23))
+    { head -c 80 ${BATS_TMPDIR}/stenomesh_fec.stl
+      printf "$(printf '\\%03o\\%03o\\%03o\\%03o' $((n&255)) $((n>>8&255)) $((n>>16&255)) $((n>>24&255)))"
+      tail -c +$((85+3*50)) ${BATS_TMPDIR}/stenomesh_fec.stl | head -c $((497*50))
+      tail -c +$((85+520*50)) ${BATS_TMPDIR}/stenomesh_fec.stl
+    } > ${BATS_TMPDIR}/stenomesh_fec_dropped.stl
+    result=$(cat ${BATS_TMPDIR}/stenomesh_fec_dropped.stl | ${BD}/stenomesh -ax)
+    [ "${result}" == "${message}" ]
+}
+
+@test "attr encoding: error correction of dropped leading facets" {
+    # Whatever bytes take the place of the length prefix
+    for size in 200 1000 3000; do
+        message=$(head -c ${size} ${BATS_TEST_DIRNAME}/../src/fec.hpp)
+        ${BATS_TEST_DIRNAME}/gen_grid.sh 40 | ${BD}/stenomesh -am "${message}" --fec 50 > ${BATS_TMPDIR}/stenomesh_fec.stl
+        for k in 1 2 3 4 5 6 7 8; do
+            n=$(($(od -An -tu4 -j80 -N4 ${BATS_TMPDIR}/stenomesh_fec.stl)-k))
+            { head -c 80 ${BATS_TMPDIR}/stenomesh_fec.stl
+              printf "$(printf '\\%03o\\%03o\\%03o\\%03o' $((n&255)) $((n>>8&255)) $((n>>16&255)) $((n>>24&255)))"
+              tail -c +$((85+k*50)) ${BATS_TMPDIR}/stenomesh_fec.stl
+            } > ${BATS_TMPDIR}/stenomesh_fec_dropped.stl
+            result=$(cat ${BATS_TMPDIR}/stenomesh_fec_dropped.stl | ${BD}/stenomesh -ax)
+            [ "${result}" == "${message}" ]
+        done
+    done
+}
+
+@test "attr encoding: error correction of dropped scattered facets" {
+    message=$(head -c 3000 ${BATS_TEST_DIRNAME}/../src/fec.hpp)
+    key=000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f
+    ${BATS_TEST_DIRNAME}/gen_grid.sh 40 | STENOMESH_KEY=${key} ${BD}/stenomesh -am "${message}" --fec 50 --scatter > ${BATS_TMPDIR}/stenomesh_fec.stl
+
+    # Drop a single facet at the start, in the middle and at the end, or the first 3 and 20 further on
+    total=$(od -An -tu4 -j80 -N4 ${BATS_TMPDIR}/stenomesh_fec.stl)
+    for drop in "0 1 0 0" "1000 1 0 0" "$((total-1)) 1 0 0" "0 3 497 20"; do
+        set -- ${drop}
+        n=$((total-$2-$4))
+        { head -c 80 ${BATS_TMPDIR}/stenomesh_fec.stl
+          printf "$(printf '\\%03o\\%03o\\%03o\\%03o' $((n&255)) $((n>>8&255)) $((n>>16&255)) $((n>>24&255)))"
+          tail -c +85 ${BATS_TMPDIR}/stenomesh_fec.stl | head -c $(($1*50))
+          tail -c +$((85+($1+$2)*50)) ${BATS_TMPDIR}/stenomesh_fec.stl | head -c $(($3*50))
+          tail -c +$((85+($1+$2+$3+$4)*50)) ${BATS_TMPDIR}/stenomesh_fec.stl
+        } > ${BATS_TMPDIR}/stenomesh_fec_dropped.stl
+        result=$(cat ${BATS_TMPDIR}/stenomesh_fec_dropped.stl | STENOMESH_KEY=${key} ${BD}/stenomesh -ax --scatter)
+        [ "${result}" == "${message}" ]
+    done
+}
+
+@test "attr encoding: scattered message" {
+    message="hello world"
+    key=000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f
+    ${BATS_TEST_DIRNAME}/gen_grid.sh 40 | STENOMESH_KEY=${key} ${BD}/stenomesh -am "${message}" --scatter -j 4 > ${BATS_TMPDIR}/stenomesh_scatter.stl
+
+    # Verify, the placement is needed and matches the out of core reader
+    result=$(cat ${BATS_TMPDIR}/stenomesh_scatter.stl | STENOMESH_KEY=${key} ${BD}/stenomesh -ax --scatter)
+    [ "${result}" == "${message}" ]
+    result=$(cat ${BATS_TMPDIR}/stenomesh_scatter.stl | STENOMESH_KEY=${key} ${BD}/stenomesh -ax --scatter --max-memory 1K)
+    [ "${result}" == "${message}" ]
+    result=$(cat ${BATS_TMPDIR}/stenomesh_scatter.stl | STENOMESH_KEY=${key} ${BD}/stenomesh -ax 2> /dev/null || true)
+    [ "${result}" != "${message}" ]
+    ! (${BATS_TEST_DIRNAME}/gen_grid.sh 8 | ${BD}/stenomesh -am "${message}" --scatter > /dev/null 2>&1)
+}
+
+@test "attr encoding: mantissa bits beyond attribute capacity" {
+    # 12 faces carry 16 attribute bits and 3 normal coordinates of 8 bits each,
+    # 8 vertices 3 coordinates of 8 bits each -> 84 byte encoding space
+    message=$(cat /dev/urandom | tr -dc 'a-zA-Z0-9' | fold -w 70 | head -n 1)
+    ! (cat ${DD}/cube_bin.ply | ${BD}/stenomesh -am "${message}" > /dev/null 2>&1)
+    result=$(cat ${DD}/cube_bin.ply | ${BD}/stenomesh -am "${message}" --lsb 8,normals 2> ${BATS_TMPDIR}/stenomesh_lsb.err | ${BD}/stenomesh -ax --lsb 8,normals)
+
+    # Verify decoded value and the reported error bound
+    [ "${result}" == "${message}" ]
+    grep -q "of the bounding box diagonal" ${BATS_TMPDIR}/stenomesh_lsb.err
+    ! (cat ${DD}/cube_bin.ply | ${BD}/stenomesh -am "${message}" --lsb 8 > /dev/null 2>&1)
+}
+
+@test "attr encoding: mantissa bits keep the topology" {
+    message=$(head -c 500 ${BATS_TEST_DIRNAME}/../src/fec.hpp)
+    before=$(${BATS_TEST_DIRNAME}/gen_grid.sh 20 | ${BD}/stenomesh -a -c 0 --topology - 2>&1 > /dev/null)
+    ${BATS_TEST_DIRNAME}/gen_grid.sh 20 | ${BD}/stenomesh -am "${message}" --lsb 4 2> /dev/null > ${BATS_TMPDIR}/stenomesh_lsb.stl
+    after=$(cat ${BATS_TMPDIR}/stenomesh_lsb.stl | ${BD}/stenomesh -a -c 0 --topology - 2>&1 > /dev/null)
+
+    # Shared corners stay identical, the vertices hold the payload
+    [ "${after}" == "${before}" ]
+    echo "${after}" | grep -q '"vertices":400,'
+    result=$(cat ${BATS_TMPDIR}/stenomesh_lsb.stl | ${BD}/stenomesh -ax --lsb 4)
+    [ "${result}" == "${message}" ]
+}
+
+@test "attr encoding: ply payload property" {
+    # 8 vertices hold 4 bytes next to the length, 12 faces hold 8
+    message="ply face"
+    ! (cat ${DD}/cube_bin.ply | ${BD}/stenomesh -am "${message}" --ply vertex > /dev/null 2>&1)
+    cat ${DD}/cube_bin.ply | ${BD}/stenomesh -am "${message}" --ply face > ${BATS_TMPDIR}/stenomesh_face.ply
+    grep -aq "property uchar steno" ${BATS_TMPDIR}/stenomesh_face.ply
+
+    # Verify decoded value, also after conversion to STL
+    result=$(cat ${BATS_TMPDIR}/stenomesh_face.ply | ${BD}/stenomesh -ax)
+    [ "${result}" == "${message}" ]
+    result=$(cat ${BATS_TMPDIR}/stenomesh_face.ply | ${BD}/stenomesh -a | ${BD}/stenomesh -ax)
+    [ "${result}" == "${message}" ]
+
+    message="ply"
+    result=$(cat ${DD}/cube_ascii.ply | ${BD}/stenomesh -am "${message}" --ply vertex | ${BD}/stenomesh -ax)
+    [ "${result}" == "${message}" ]
+}
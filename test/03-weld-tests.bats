@@ -0,0 +1,99 @@
+#!/usr/bin/env bats
+
+BD=${BATS_TEST_DIRNAME}/..
+DD=${BATS_TEST_DIRNAME}/data
+
+face_count() {
+    head -c 84 | tail -c 4 | od -An -tu4 | tr -d ' '
+}
+
+@test "weld: exact weld keeps geometry" {
+    stl=$(mktemp -t stenomesh.test.XXXXXXXXX.stl)
+    ${BATS_TEST_DIRNAME}/gen_grid.sh 50 | ${BD}/stenomesh > $stl
+
+    plain=$(cat $stl | ${BD}/stenomesh | sha1sum | awk '{print $1}')
+    welded=$(cat $stl | ${BD}/stenomesh -c 0 | sha1sum | awk '{print $1}')
+    rm $stl
+
+    # Verify
+    [ $welded == $plain ]
+}
+
+@test "weld: collapse drops degenerate faces" {
+    # grid spacing is 0.1, a collapse length of 1 merges most vertices
+    result=$(${BATS_TEST_DIRNAME}/gen_grid.sh 50 | ${BD}/stenomesh -c 1 | face_count)
+
+    # Verify
+    [ $result -lt 4802 ]
+}
+
+@test "weld: sort strategy matches map strategy" {
+    map=$(${BATS_TEST_DIRNAME}/gen_grid.sh 50 | ${BD}/stenomesh -w map -c 0.3 | sha1sum | awk '{print $1}')
+    sort=$(${BATS_TEST_DIRNAME}/gen_grid.sh 50 | ${BD}/stenomesh -w sort -c 0.3 | sha1sum | awk '{print $1}')
+
+    # Verify
+    [ $sort == $map ]
+}
+
+@test "weld: grid strategy merges across cell boundaries" {
+    # seam_ascii.stl has a sliver facet with 2 vertices 0.001 apart around x=0.1
+    map=$(cat ${DD}/seam_ascii.stl | ${BD}/stenomesh -w map -c 0.01 | face_count)
+    grid=$(cat ${DD}/seam_ascii.stl | ${BD}/stenomesh -w grid -c 0.01 | face_count)
+
+    # Verify the sliver only collapses with the radius weld
+    [ $grid == 1 ]
+    [ $map == 2 ]
+}
+
+@test "weld: grid strategy on a mesh without close vertices" {
+    map=$(${BATS_TEST_DIRNAME}/gen_grid.sh 50 | ${BD}/stenomesh -w map -c 0.01 | sha1sum | awk '{print $1}')
+    grid=$(${BATS_TEST_DIRNAME}/gen_grid.sh 50 | ${BD}/stenomesh -w grid -c 0.01 | sha1sum | awk '{print $1}')
+
+    # Verify
+    [ $grid == $map ]
+}
+
+@test "weld: welding while parsing matches welding afterwards" {
+    stl=$(mktemp -t stenomesh.test.XXXXXXXXX.stl)
+    ${BATS_TEST_DIRNAME}/gen_grid.sh 50 | ${BD}/stenomesh > $stl
+
+    # STL input is welded while parsing, except for the sort strategy
+    fused=$(cat $stl | ${BD}/stenomesh -w map -c 0.3 | sha1sum | awk '{print $1}')
+    after=$(cat $stl | ${BD}/stenomesh -w sort -c 0.3 | sha1sum | awk '{print $1}')
+    rm $stl
+
+    # Verify
+    [ $fused == $after ]
+}
+
+@test "weld: out of core weld matches in-core weld" {
+    stl=$(mktemp -t stenomesh.test.XXXXXXXXX.stl)
+    ${BATS_TEST_DIRNAME}/gen_grid.sh 200 | ${BD}/stenomesh -am "hello" > $stl
+
+    # 79202 faces do not fit 1M, the weld spills to temporary files
+    in_core=$(cat $stl | ${BD}/stenomesh -c 0.3 -w sort | sha1sum | awk '{print $1}')
+    out_of_core=$(cat $stl | ${BD}/stenomesh -c 0.3 --max-memory 1M | sha1sum | awk '{print $1}')
+    # with 64K the runs outnumber the merge fan-in and are merged in passes
+    passes=$(cat $stl | ${BD}/stenomesh -c 0.3 --max-memory 64K | sha1sum | awk '{print $1}')
+    rm $stl
+
+    # Verify
+    [ $out_of_core == $in_core ]
+    [ $passes == $in_core ]
+}
+
+@test "weld: grid strategy ignores the memory limit" {
+    # the radius weld has no out of core counterpart and always runs in core
+    in_core=$(cat ${DD}/seam_ascii.stl | ${BD}/stenomesh -w grid -c 0.01 | sha1sum | awk '{print $1}')
+    limited=$(cat ${DD}/seam_ascii.stl | ${BD}/stenomesh -w grid -c 0.01 --max-memory 100 | sha1sum | awk '{print $1}')
+    [ $limited == $in_core ]
+
+    stl=$(mktemp -t stenomesh.test.XXXXXXXXX.stl)
+    ${BATS_TEST_DIRNAME}/gen_grid.sh 100 | ${BD}/stenomesh > $stl
+    in_core=$(cat $stl | ${BD}/stenomesh -w grid -c 0.15 | sha1sum | awk '{print $1}')
+    limited=$(cat $stl | ${BD}/stenomesh -w grid -c 0.15 --max-memory 1K | sha1sum | awk '{print $1}')
+    rm $stl
+
+    # Verify
+    [ $limited == $in_core ]
+}
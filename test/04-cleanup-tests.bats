@@ -0,0 +1,20 @@
+#!/usr/bin/env bats
+
+BD=${BATS_TEST_DIRNAME}/..
+DD=${BATS_TEST_DIRNAME}/data
+
+@test "cleanup: remove degenerate and duplicate faces" {
+    # dirty_cube_ascii.ply is cube_ascii.ply with 4 bad faces appended
+    clean=$(cat ${DD}/cube_ascii.ply | ${BD}/stenomesh -h cube | sha1sum | awk '{print $1}')
+    result=$(cat ${DD}/dirty_cube_ascii.ply | ${BD}/stenomesh -d -h cube 2> /dev/null | sha1sum | awk '{print $1}')
+
+    # Verify
+    [ $result == $clean ]
+}
+
+@test "cleanup: report removed face counts" {
+    result=$(cat ${DD}/dirty_cube_ascii.ply | ${BD}/stenomesh -d 2>&1 > /dev/null)
+
+    # Verify
+    [ "${result}" == "Removed 2 degenerate and 2 duplicate faces" ]
+}
@@ -0,0 +1,74 @@
+#!/usr/bin/env bats
+
+BD=${BATS_TEST_DIRNAME}/..
+DD=${BATS_TEST_DIRNAME}/data
+
+setup() {
+    LIBCHECK=${BATS_TMPDIR}/stenomesh.libcheck
+    if [ ! -x ${LIBCHECK} ] || [ ${BD}/libstenomesh.a -nt ${LIBCHECK} ] || [ ${BATS_TEST_DIRNAME}/libcheck.cpp -nt ${LIBCHECK} ]; then
+        ${CXX:-g++} --std=gnu++17 -pthread -o ${LIBCHECK} ${BATS_TEST_DIRNAME}/libcheck.cpp ${BD}/libstenomesh.a
+    fi
+}
+
+@test "library: embed matches commandline" {
+    message="hello library"
+    lib=$(cat ${DD}/cube_bin.ply | ${LIBCHECK} embed "${message}" | sha1sum | awk '{print $1}')
+    cli=$(cat ${DD}/cube_bin.ply | ${BD}/stenomesh -j 0 -am "${message}" | sha1sum | awk '{print $1}')
+
+    # Verify
+    [ $lib == $cli ]
+}
+
+@test "library: extract embedded message" {
+    message="hello library"
+    result=$(cat ${DD}/cube_ascii.ply | ${BD}/stenomesh -am "${message}" | ${LIBCHECK} extract)
+
+    # Verify
+    [ "${result}" == "${message}" ]
+}
+
+@test "library: capacity" {
+    # 12 face cube -> 24 byte attr space -> 4 byte length prefix -> 20 byte encoding space
+    result=$(cat ${DD}/cube_bin.ply | ${LIBCHECK} capacity)
+
+    # Verify
+    [ $result -eq 20 ]
+}
+
+@test "library: overflow message" {
+    run ${LIBCHECK} embed "$(printf 'x%.0s' {1..21})" < ${DD}/cube_bin.ply
+
+    # Verify
+    [ $status -ne 0 ]
+}
+
+@test "library: chacha20 RFC 8439 test vector" {
+    # RFC 8439 section 2.4.2
+    key=000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f
+    result=$(printf "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, sunscreen would be it." | ${LIBCHECK} chacha20 ${key} 000000000000004a00000000 1 | od -An -tx1 -v | tr -d ' \n')
+
+    # Verify
+    [ "${result}" == "6e2e359a2568f98041ba0728dd0d6981e97e7aec1d4360c20a27afccfd9fae0bf91b65c5524733ab8f593dabcd62b3571639d624e65152ab8f530c359f0861d807ca0dbf500d6a6156a38e088a22b65e52bc514d16ccf806818ce91ab77937365af90bbf74a35be6b40b8eedf2785e42874d" ]
+}
+
+@test "library: chacha20 wide blocks match single blocks" {
+    # 1000 bytes run the 8 and 4 block paths and the single block tail at once,
+    # each 64 byte block on its own only runs the single block function
+    key=000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f
+    nonce=000000090000004a00000000
+    head -c 1000 /dev/urandom > ${BATS_TMPDIR}/stenomesh_chacha.bin
+    wide=$(${LIBCHECK} chacha20 ${key} ${nonce} 7 < ${BATS_TMPDIR}/stenomesh_chacha.bin | sha1sum | awk '{print $1}')
+    single=$(for i in $(seq 0 15); do
+                 dd if=${BATS_TMPDIR}/stenomesh_chacha.bin bs=64 skip=$i count=1 2>/dev/null | ${LIBCHECK} chacha20 ${key} ${nonce} $((7+i))
+             done | sha1sum | awk '{print $1}')
+
+    # Verify
+    [ $wide == $single ]
+}
+
+@test "library: crc32c check value" {
+    result=$(printf 123456789 | ${LIBCHECK} crc32c)
+
+    # Verify
+    [ "${result}" == "e3069283" ]
+}
@@ -0,0 +1,97 @@
+#!/usr/bin/env bats
+
+BD=${BATS_TEST_DIRNAME}/..
+DD=${BATS_TEST_DIRNAME}/data
+
+u64le() {
+    for i in 0 1 2 3 4 5 6 7; do
+        printf "\\x$(printf %02x $(( ($1 >> (8*i)) & 255 )))"
+    done
+}
+
+# request <op> <source> <mesh_size> <payload_size>
+request() {
+    printf "$1\\x0$2\\x00\\x00\\x00\\x00\\x00\\x00"
+    u64le $3
+    u64le $4
+}
+
+@test "server: capacity of inline mesh" {
+    size=$(stat -c %s ${DD}/cube_bin.ply)
+    result=$({ request c 0 $size 0; cat ${DD}/cube_bin.ply; } | ${BD}/stenomesh --serve - | tail -c 8 | od -An -tu8 | tr -d ' ')
+
+    # Verify
+    [ $result -eq 20 ]
+}
+
+@test "server: embed by path matches commandline" {
+    message="hello server"
+    path=${DD}/cube_bin.ply
+    served=$({ request e 1 ${#path} ${#message}; printf "%s%s" $path "$message"; } | ${BD}/stenomesh -j 1 --serve - | tail -c +17 | sha1sum | awk '{print $1}')
+    cli=$(cat ${DD}/cube_bin.ply | ${BD}/stenomesh -am "${message}" | sha1sum | awk '{print $1}')
+
+    # Verify
+    [ $served == $cli ]
+}
+
+@test "server: error keeps the stream in sync" {
+    path=/nonexistent/mesh.stl
+    size=$(stat -c %s ${DD}/cube_bin.ply)
+    out=$(mktemp -t stenomesh.test.XXXXXXXXX)
+    { request x 1 ${#path} 0; printf "%s" $path; request c 0 $size 0; cat ${DD}/cube_bin.ply; } | ${BD}/stenomesh --serve - > $out
+    status=$(head -c 1 $out | od -An -tu1 | tr -d ' ')
+    result=$(tail -c 8 $out | od -An -tu8 | tr -d ' ')
+    rm $out
+
+    # Verify error status followed by the capacity response
+    [ $status -eq 1 ]
+    [ $result -eq 20 ]
+}
+
+@test "server: oversized frame is refused before allocating" {
+    out=$(mktemp -t stenomesh.test.XXXXXXXXX)
+    request c 0 $((1<<62)) 0 | ${BD}/stenomesh --serve - > $out
+    status=$(head -c 1 $out | od -An -tu1 | tr -d ' ')
+    message=$(tail -c +17 $out)
+    { request x 1 5000 0; head -c 5000 /dev/zero; } | ${BD}/stenomesh --serve - > $out
+    path_message=$(tail -c +17 $out)
+    size=$(stat -c %s ${DD}/cube_bin.ply)
+    { request c 0 $size 0; cat ${DD}/cube_bin.ply; } | ${BD}/stenomesh --max-memory 100 --serve - > $out
+    limit_message=$(tail -c +17 $out)
+    rm $out
+
+    # Verify error responses
+    [ $status -eq 1 ]
+    [ "${message}" == "Request frame exceeds the memory limit" ]
+    [ "${path_message}" == "Mesh path too long" ]
+    [ "${limit_message}" == "Request frame exceeds the memory limit" ]
+}
+
+@test "server: idle connections hold no worker" {
+    command -v python3 > /dev/null || skip "python3 drives the socket"
+    sock=${BATS_TMPDIR}/stenomesh_test.sock
+    ${BD}/stenomesh -j 1 --serve ${sock} &
+    server=$!
+    for i in $(seq 50); do [ -S ${sock} ] && break; sleep 0.1; done
+
+    # A kept alive connection and a second client share the single worker
+    result=$(timeout 10 python3 - ${sock} ${DD}/cube_bin.ply <<'PY'
+import socket, struct, sys
+mesh = open(sys.argv[2], 'rb').read()
+def capacity(s):
+    s.sendall(b'c\0' + bytes(6) + struct.pack('<QQ', len(mesh), 0) + mesh)
+    r = b''
+    while len(r) < 24:
+        r += s.recv(24 - len(r)) or sys.exit('closed')
+    return struct.unpack('<Q', r[16:])[0]
+idle, other = socket.socket(socket.AF_UNIX), socket.socket(socket.AF_UNIX)
+idle.connect(sys.argv[1])
+other.connect(sys.argv[1])
+print(capacity(idle), capacity(other), capacity(idle))
+PY
+)
+    kill ${server}
+
+    # Verify
+    [ "${result}" == "20 20 20" ]
+}
@@ -0,0 +1,56 @@
+#!/usr/bin/env bats
+
+BD=${BATS_TEST_DIRNAME}/..
+DD=${BATS_TEST_DIRNAME}/data
+
+@test "probe: ply header" {
+    result=$(cat ${DD}/cube_bin.ply | ${BD}/stenomesh --probe)
+
+    # Verify
+    [ "${result}" == '{"format":"ply","ply_format":"binary_little_endian","faces":12,"vertices":8,"comment":"VCGLIB generated\n","capacity":20,"payload":false}' ]
+}
+
+@test "probe: binary stl payload prefix" {
+    result=$(cat ${DD}/cube_bin.ply | ${BD}/stenomesh -am "hello" | ${BD}/stenomesh --probe)
+
+    # Verify
+    [ "${result}" == '{"format":"stl_binary","faces":12,"vertices":36,"comment":"VCGLIB generated\n","capacity":20,"payload":true,"payload_length":5}' ]
+}
+
+@test "probe: ascii stl facet count" {
+    result=$(cat ${DD}/seam_ascii.stl | ${BD}/stenomesh --probe)
+
+    # Verify
+    [ "${result}" == '{"format":"stl_ascii","faces":2,"vertices":6,"comment":"seam","capacity":0,"payload":false}' ]
+}
+
+@test "probe: compressed payload" {
+    result=$(cat ${DD}/cube_bin.ply | ${BD}/stenomesh -azm "$(printf 'ab%.0s' $(seq 30))" | ${BD}/stenomesh --probe)
+
+    # Verify
+    [ "${result}" == '{"format":"stl_binary","faces":12,"vertices":36,"comment":"VCGLIB generated\n","capacity":20,"payload":true,"payload_length":16,"payload_encoding":["lz"]}' ]
+}
+
+@test "probe: payload checksum" {
+    result=$(cat ${DD}/cube_bin.ply | ${BD}/stenomesh -am "hello" --checksum | ${BD}/stenomesh --probe)
+
+    # Verify
+    [ "${result}" == '{"format":"stl_binary","faces":12,"vertices":36,"comment":"VCGLIB generated\n","capacity":20,"payload":true,"payload_length":9,"payload_encoding":["crc32c"],"checksum_valid":true}' ]
+}
+
+@test "probe: ply payload property" {
+    result=$(cat ${DD}/cube_bin.ply | ${BD}/stenomesh -am "hi" --checksum --ply face | ${BD}/stenomesh --probe)
+
+    # Verify, the faces hold a byte each
+    [ "${result}" == '{"format":"ply","ply_format":"binary_little_endian","payload_element":"face","faces":12,"vertices":8,"comment":"VCGLIB generated\n","capacity":8,"payload":true,"payload_length":6,"payload_encoding":["crc32c"],"checksum_valid":true}' ]
+}
+
+@test "probe: scattered payload" {
+    key=000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f
+    ${BATS_TEST_DIRNAME}/gen_grid.sh 40 | STENOMESH_KEY=${key} ${BD}/stenomesh -am "hello world" --checksum --scatter > ${BATS_TMPDIR}/stenomesh_probe.stl
+    result=$(cat ${BATS_TMPDIR}/stenomesh_probe.stl | STENOMESH_KEY=${key} ${BD}/stenomesh --probe --scatter)
+
+    # Verify, the placement needs the key
+    [ "${result}" == '{"format":"stl_binary","faces":3042,"vertices":9126,"comment":"stenomesh test grid\n","capacity":6080,"payload":true,"payload_length":27,"payload_encoding":["chacha20","crc32c"],"checksum_valid":true}' ]
+    ! (cat ${BATS_TMPDIR}/stenomesh_probe.stl | ${BD}/stenomesh --probe --scatter > /dev/null 2>&1)
+}
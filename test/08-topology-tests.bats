@@ -0,0 +1,31 @@
+#!/usr/bin/env bats
+
+BD=${BATS_TEST_DIRNAME}/..
+DD=${BATS_TEST_DIRNAME}/data
+
+@test "topology: closed cube" {
+    result=$(cat ${DD}/cube_bin.ply | ${BD}/stenomesh --topology - 2>&1 >/dev/null)
+
+    # Verify
+    [ "${result}" == '{"triangles":12,"vertices":8,"edges":18,"boundary_edges":0,"non_manifold_edges":0,"inconsistent_edges":0,"components":1,"euler":2,"watertight":true,"manifold":true,"oriented":true}' ]
+}
+
+@test "topology: open grid" {
+    # 4x4 vertex grid -> 12 boundary edges
+    result=$(${BATS_TEST_DIRNAME}/gen_grid.sh 4 | ${BD}/stenomesh --topology - 2>&1 >/dev/null)
+
+    # Verify
+    [ "${result}" == '{"triangles":18,"vertices":16,"edges":33,"boundary_edges":12,"non_manifold_edges":0,"inconsistent_edges":0,"components":1,"euler":1,"watertight":false,"manifold":true,"oriented":true}' ]
+}
+
+@test "topology: watertight validation" {
+    cat ${DD}/cube_bin.ply | ${BD}/stenomesh -v watertight,oriented > /dev/null
+    ! (cat ${DD}/seam_ascii.stl | ${BD}/stenomesh -v watertight > /dev/null 2>&1)
+}
+
+@test "topology: STL soup welded for validation" {
+    # Without -c the exact duplicates of the facet soup are welded
+    cat ${DD}/cube_bin.ply | ${BD}/stenomesh | ${BD}/stenomesh -v watertight,manifold,oriented > /dev/null
+    result=$(cat ${DD}/cube_bin.ply | ${BD}/stenomesh | ${BD}/stenomesh --topology - 2>&1 >/dev/null)
+    [ "${result}" == '{"triangles":12,"vertices":8,"edges":18,"boundary_edges":0,"non_manifold_edges":0,"inconsistent_edges":0,"components":1,"euler":2,"watertight":true,"manifold":true,"oriented":true}' ]
+}
@@ -0,0 +1,42 @@
+#!/usr/bin/env bats
+
+BD=${BATS_TEST_DIRNAME}/..
+DD=${BATS_TEST_DIRNAME}/data
+
+@test "trace: stage spans" {
+    trace=${BATS_TMPDIR}/stenomesh_trace.json
+    cat ${DD}/seam_ascii.stl | ${BD}/stenomesh -c 0 -d --trace ${trace} > /dev/null
+
+    # Verify
+    grep -q '"traceEvents"' ${trace}
+    grep -q '"name":"parse"' ${trace}
+    grep -q '"name":"cleanup"' ${trace}
+    grep -q '"name":"finish"' ${trace}
+
+}
+
+@test "trace: exact timestamps" {
+    trace=${BATS_TMPDIR}/stenomesh_trace_grid.json
+    ${BATS_TEST_DIRNAME}/gen_grid.sh 100 | ${BD}/stenomesh -c 0 --trace ${trace} > /dev/null
+
+    # Verify, microseconds with 3 decimals also beyond 6 significant digits
+    grep -q '"ts":[0-9]\{4,\}\.' ${trace}
+    ! grep '"ph":"X"' ${trace} | grep -vq '"ts":[0-9]*\.[0-9][0-9][0-9],"dur":[0-9]*\.[0-9][0-9][0-9]}'
+}
+
+@test "trace: written when validation fails" {
+    trace=${BATS_TMPDIR}/stenomesh_trace_fail.json
+    ! (cat ${DD}/seam_ascii.stl | ${BD}/stenomesh -v watertight --trace ${trace} > /dev/null 2>&1)
+
+    # Verify
+    grep -q '"name":"topology"' ${trace}
+}
+
+@test "trace: perf counters" {
+    expected=$(cat ${DD}/seam_ascii.stl | ${BD}/stenomesh -c 0 | md5sum)
+    result=$(cat ${DD}/seam_ascii.stl | ${BD}/stenomesh -c 0 --perf-counters 2>${BATS_TMPDIR}/stenomesh_perf.txt | md5sum)
+
+    # Verify, counters may not be permitted on the test machine
+    [ "${result}" == "${expected}" ]
+    grep -q '^parse \|^Performance counters unavailable' ${BATS_TMPDIR}/stenomesh_perf.txt
+}
@@ -0,0 +1,16 @@
+#!/usr/bin/env bash
+# Writes an ascii PLY of a wavy N x N vertex grid (2*(N-1)^2 triangles) to stdout
+N=${1:-100}
+awk -v n=$N 'BEGIN {
+  print "ply"; print "format ascii 1.0"; print "comment stenomesh test grid"
+  print "element vertex " n*n
+  print "property float x"; print "property float y"; print "property float z"
+  print "element face " 2*(n-1)*(n-1)
+  print "property list uchar int vertex_indices"; print "end_header"
+  for (j=0; j<n; j++) for (i=0; i<n; i++) printf "%g %g %g\n", i/10, j/10, sin(i/7)*cos(j/5)
+  for (j=0; j<n-1; j++) for (i=0; i<n-1; i++) {
+    v = j*n+i
+    printf "3 %d %d %d\n", v, v+1, v+n+1
+    printf "3 %d %d %d\n", v, v+n+1, v+n
+  }
+}'
@@ -0,0 +1,81 @@
+// Copyright (C) 2019 hrobeers (https://github.com/hrobeers)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// Drives the library API from the commandline for the bats tests:
+//   libcheck embed <message> < meshfile
+//   libcheck extract < meshfile
+//   libcheck capacity < meshfile
+//   libcheck chacha20 <key hex> <nonce hex> <counter> < data
+//   libcheck crc32c < data
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+#include <string>
+
+#include "../src/libstenomesh.hpp"
+#include "../src/chacha20.hpp"
+#include "../src/crc32c.hpp"
+
+// Hex string to bytes, n bytes are expected
+static bool unhex(const std::string &hex, unsigned char *out, size_t n)
+{
+  if (hex.size()!=2*n)
+    return false;
+  for (size_t i=0; i<n; i++)
+    out[i] = (unsigned char)std::stoul(hex.substr(2*i, 2), nullptr, 16);
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc<2) {
+    std::cerr << "usage: " << argv[0] << " <embed <message>|extract|capacity|chacha20 <key> <nonce> <counter>|crc32c> < file" << std::endl;
+    return 1;
+  }
+  std::string mesh((std::istreambuf_iterator<char>(std::cin)), std::istreambuf_iterator<char>());
+  std::string cmd(argv[1]);
+  try {
+    if (cmd=="embed" && argc>2) {
+      auto out = stenomesh::embed(mesh, argv[2]);
+      std::cout.write(out.data(), out.size());
+    }
+    else if (cmd=="extract")
+      std::cout << stenomesh::extract(mesh);
+    else if (cmd=="capacity")
+      std::cout << stenomesh::capacity(mesh) << std::endl;
+    else if (cmd=="chacha20" && argc>4) {
+      unsigned char key[32], nonce[12];
+      if (!unhex(argv[2], key, sizeof(key)) || !unhex(argv[3], nonce, sizeof(nonce)))
+        return 1;
+      stenomesh::chacha20_xor(key, nonce, (uint32_t)std::strtoul(argv[4], nullptr, 10), mesh.data(), &mesh[0], mesh.size());
+      std::cout.write(mesh.data(), mesh.size());
+    }
+    else if (cmd=="crc32c") {
+      char hex[9];
+      std::snprintf(hex, sizeof(hex), "%08x", stenomesh::crc32c(mesh.data(), mesh.size()));
+      std::cout << hex << std::endl;
+    }
+    else
+      return 1;
+  }
+  catch (const std::exception &e) {
+    std::cerr << "Critical error: " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}